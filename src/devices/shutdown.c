@@ -8,10 +8,21 @@
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/exception.h"
+#include "userprog/pagedir.h"
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
+#include "filesys/cache.h"
+#include "filesys/dentry.h"
+#include "filesys/directory.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
+#endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/merge.h"
+#include "vm/swap.h"
 #endif
 
 /* Keyboard control register port. */
@@ -133,10 +144,21 @@ print_stats (void)
   thread_print_stats ();
 #ifdef FILESYS
   block_print_stats ();
+  cache_print_stats ();
+  free_map_print_stats ();
+  inode_print_stats ();
+  dir_print_stats ();
+  dentry_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
 #ifdef USERPROG
   exception_print_stats ();
+  pagedir_print_stats ();
+#endif
+#ifdef VM
+  frame_print_stats ();
+  merge_print_stats ();
+  swap_print_stats ();
 #endif
 }
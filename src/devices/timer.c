@@ -84,6 +84,17 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
+/* Returns the CPU's time-stamp counter, which counts clock
+   cycles, for timing intervals much shorter than a tick. */
+uint64_t
+timer_cycles (void) 
+{
+  /* See [IA32-v2b] "RDTSC". */
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
    be turned on. */
 void
@@ -0,0 +1,87 @@
+/* dir-bench.c
+
+   Times directory operations in a large directory.  Creates
+   COUNT empty files in the root directory, opens and closes each
+   of them, then removes them, and reports CPU cycles for each
+   phase and per file.  With a directory that is searched
+   linearly, the time per file grows with COUNT; with hashed
+   lookup it should stay about the same.
+
+   The file system must have room for COUNT inodes, one sector
+   each, plus the directory itself.
+
+   Usage: dir-bench [COUNT] */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+
+/* Reads the CPU's time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Prints the time taken by a phase over CNT files. */
+static void
+report (const char *phase, uint64_t cycles, int cnt)
+{
+  printf ("%-8s %14llu cycles, %10llu cycles/file\n",
+          phase, cycles, cnt > 0 ? cycles / cnt : 0);
+}
+
+int
+main (int argc, char *argv[])
+{
+  int cnt = argc > 1 ? atoi (argv[1]) : 10000;
+  char name[16];
+  uint64_t start;
+  int i;
+
+  start = rdtsc ();
+  for (i = 0; i < cnt; i++)
+    {
+      snprintf (name, sizeof name, "db%d", i);
+      if (!create (name, 0))
+        {
+          printf ("create %s failed\n", name);
+          cnt = i;
+          break;
+        }
+    }
+  report ("create", rdtsc () - start, cnt);
+
+  start = rdtsc ();
+  for (i = 0; i < cnt; i++)
+    {
+      int fd;
+
+      snprintf (name, sizeof name, "db%d", i);
+      fd = open (name);
+      if (fd < 0)
+        {
+          printf ("open %s failed\n", name);
+          return EXIT_FAILURE;
+        }
+      close (fd);
+    }
+  report ("open", rdtsc () - start, cnt);
+
+  start = rdtsc ();
+  for (i = 0; i < cnt; i++)
+    {
+      snprintf (name, sizeof name, "db%d", i);
+      if (!remove (name))
+        {
+          printf ("remove %s failed\n", name);
+          return EXIT_FAILURE;
+        }
+    }
+  report ("remove", rdtsc () - start, cnt);
+
+  return EXIT_SUCCESS;
+}
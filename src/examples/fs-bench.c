@@ -0,0 +1,95 @@
+/* fs-bench.c
+
+   Times concurrent file system use by several processes.  For 1,
+   2 and 4 processes in turn, each child creates its own file,
+   writes it in 512-byte chunks, reads it back twice from the
+   start, asking for its position after every read, then removes
+   it.  Reports CPU cycles for each round and per kB moved, so
+   that rounds with more processes show how well file system
+   calls from different processes overlap instead of waiting for
+   each other.
+
+   Usage: fs-bench [KB] */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+
+/* Most processes run at once. */
+#define MAX_PROCS 4
+
+/* Reads the CPU's time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Writes, reads back and removes a file of KB kilobytes named
+   after ID.  Returns 0 if successful. */
+static int
+child (int id, int kb)
+{
+  char name[16], buf[512];
+  int fd, i, pass;
+
+  snprintf (name, sizeof name, "fsb%d", id);
+  if (!create (name, 0) || (fd = open (name)) < 0)
+    return 1;
+
+  memset (buf, id, sizeof buf);
+  for (i = 0; i < kb * 2; i++)
+    if (write (fd, buf, sizeof buf) != sizeof buf)
+      return 2;
+
+  for (pass = 0; pass < 2; pass++)
+    {
+      seek (fd, 0);
+      for (i = 0; i < kb * 2; i++)
+        if (read (fd, buf, sizeof buf) != sizeof buf
+            || buf[0] != id || tell (fd) != (unsigned) (i + 1) * sizeof buf)
+          return 3;
+    }
+
+  close (fd);
+  return remove (name) ? 0 : 4;
+}
+
+int
+main (int argc, char *argv[])
+{
+  int kb = argc > 1 ? atoi (argv[1]) : 64;
+  int nproc;
+
+  /* Child: "fs-bench KB -c ID". */
+  if (argc > 3 && !strcmp (argv[2], "-c"))
+    return child (atoi (argv[3]), kb);
+
+  for (nproc = 1; nproc <= MAX_PROCS; nproc *= 2)
+    {
+      pid_t pids[MAX_PROCS];
+      uint64_t start, cycles;
+      int i, failed = 0;
+
+      start = rdtsc ();
+      for (i = 0; i < nproc; i++)
+        {
+          char cmd[64];
+          snprintf (cmd, sizeof cmd, "fs-bench %d -c %d", kb, i);
+          pids[i] = exec (cmd);
+        }
+      for (i = 0; i < nproc; i++)
+        if (pids[i] == PID_ERROR || wait (pids[i]) != 0)
+          failed++;
+      cycles = rdtsc () - start;
+
+      printf ("%d process%s: %12llu cycles, %8llu cycles/kB%s\n",
+              nproc, nproc > 1 ? "es" : "  ", cycles,
+              cycles / (nproc * kb * 3), failed ? " (FAILED)" : "");
+    }
+  return EXIT_SUCCESS;
+}
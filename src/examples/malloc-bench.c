@@ -0,0 +1,95 @@
+/* malloc-bench.c
+
+   Times the user malloc() on three patterns: allocating and at
+   once freeing blocks of one size, which should be served from
+   the free list every time; holding a pool of blocks of random
+   sizes and replacing one at random each step; and growing a
+   buffer with realloc().  Reports CPU cycles per operation and
+   how far the heap grew.
+
+   Usage: malloc-bench [STEPS] */
+
+#include <random.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <syscall.h>
+
+/* Blocks held at once by the random pattern. */
+#define POOL_SIZE 256
+
+/* Reads the CPU's time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Prints the cycles per operation taken by CNT operations since
+   START. */
+static void
+report (const char *name, uint64_t start, int cnt)
+{
+  printf ("%-10s %8d ops, %6llu cycles/op\n",
+          name, cnt, (rdtsc () - start) / cnt);
+}
+
+int
+main (int argc, char *argv[])
+{
+  static void *pool[POOL_SIZE];
+  int steps = argc > 1 ? atoi (argv[1]) : 100000;
+  char *heap_start = sbrk (0);
+  uint64_t start;
+  char *buf;
+  int i;
+
+  random_init (0);
+
+  /* Same size, freed at once. */
+  start = rdtsc ();
+  for (i = 0; i < steps; i++)
+    free (malloc (64));
+  report ("same-size", start, 2 * steps);
+
+  /* Random sizes, up to 4 kB, random lifetimes. */
+  start = rdtsc ();
+  for (i = 0; i < steps; i++)
+    {
+      int slot = random_ulong () % POOL_SIZE;
+      free (pool[slot]);
+      pool[slot] = malloc (random_ulong () % 4096 + 1);
+      if (pool[slot] == NULL)
+        {
+          printf ("malloc-bench: out of memory\n");
+          return 1;
+        }
+      memset (pool[slot], i, 16);
+    }
+  report ("random", start, 2 * steps);
+  for (i = 0; i < POOL_SIZE; i++)
+    free (pool[i]);
+
+  /* A growing buffer. */
+  start = rdtsc ();
+  buf = NULL;
+  for (i = 1; i <= steps / 10; i++)
+    {
+      buf = realloc (buf, i * 8);
+      if (buf == NULL)
+        {
+          printf ("malloc-bench: out of memory\n");
+          return 1;
+        }
+      buf[i * 8 - 1] = i;
+    }
+  report ("realloc", start, steps / 10);
+  free (buf);
+
+  printf ("heap grew by %d kB\n", ((char *) sbrk (0) - heap_start) / 1024);
+  return 0;
+}
@@ -0,0 +1,111 @@
+/* ping-pong.c
+
+   Times passing control back and forth between two processes.
+   The parent and a child take turns through a one-byte token in
+   a shared file: each rereads it, yielding the CPU until the
+   token names it, then hands the token to the other.  Reports
+   CPU cycles per round trip, which takes two address space
+   switches and the TLB misses that follow each.  Compare runs
+   with and without the kernel's -nopge option to see what
+   keeping kernel TLB entries across switches saves.
+
+   Usage: ping-pong [ROUNDS] */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+
+/* File holding the token. */
+#define TOKEN_FILE "ping-pong.tok"
+
+/* Reads the CPU's time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Yields until the token in FD is ME. */
+static void
+wait_turn (int fd, char me)
+{
+  for (;;)
+    {
+      char token;
+
+      seek (fd, 0);
+      if (read (fd, &token, 1) == 1 && token == me)
+        return;
+      yield ();
+    }
+}
+
+/* Hands the token in FD to TO. */
+static void
+pass (int fd, char to)
+{
+  seek (fd, 0);
+  write (fd, &to, 1);
+}
+
+int
+main (int argc, char *argv[])
+{
+  int rounds = argc > 1 ? atoi (argv[1]) : 1000;
+  char cmd[64];
+  uint64_t start, cycles;
+  pid_t pid;
+  int fd, i;
+
+  /* Child: "ping-pong ROUNDS -c".  One more round than timed,
+     to warm up. */
+  if (argc > 2 && !strcmp (argv[2], "-c"))
+    {
+      fd = open (TOKEN_FILE);
+      if (fd < 0)
+        return 1;
+      for (i = 0; i <= rounds; i++)
+        {
+          wait_turn (fd, 'c');
+          pass (fd, 'p');
+        }
+      return 0;
+    }
+
+  remove (TOKEN_FILE);
+  if (!create (TOKEN_FILE, 1) || (fd = open (TOKEN_FILE)) < 0)
+    {
+      printf ("ping-pong: can't create %s\n", TOKEN_FILE);
+      return EXIT_FAILURE;
+    }
+  snprintf (cmd, sizeof cmd, "ping-pong %d -c", rounds);
+  pid = exec (cmd);
+  if (pid == PID_ERROR)
+    {
+      printf ("ping-pong: can't start child\n");
+      return EXIT_FAILURE;
+    }
+
+  /* Warm-up round, which waits for the child to load. */
+  pass (fd, 'c');
+  wait_turn (fd, 'p');
+
+  start = rdtsc ();
+  for (i = 0; i < rounds; i++)
+    {
+      pass (fd, 'c');
+      wait_turn (fd, 'p');
+    }
+  cycles = rdtsc () - start;
+
+  wait (pid);
+  close (fd);
+  remove (TOKEN_FILE);
+  printf ("%d round trips: %12llu cycles, %8llu cycles each\n",
+          rounds, cycles, rounds > 0 ? cycles / rounds : 0);
+  return EXIT_SUCCESS;
+}
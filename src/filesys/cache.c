@@ -0,0 +1,495 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Buffer cache for sectors of the file system device.
+
+   All file system I/O goes through a fixed set of sector-sized
+   buffers, found by sector number in a hash table and replaced
+   by the clock algorithm.
+
+   Writes only dirty the buffer.  The "fs-flush" thread writes
+   dirty buffers back every cache_flush_msecs, or sooner once
+   half the cache is dirty, in order of sector number so that
+   runs of adjacent sectors reach the disk back to back.  A
+   thread that needs to replace a dirty buffer writes it back
+   itself.  cache_flush() writes everything, at shutdown.
+
+   cache_readahead() queues a sector to be read into the cache by
+   the "fs-readahead" thread, so that a reader moving sequentially
+   through a file finds the next sectors already there.
+
+   cache_lock protects the table, the clock hand, and each
+   buffer's sector, pin count, and dirty bit.  A buffer's own
+   lock protects its contents, and is held while it is read from
+   or written to disk.  Only unpinned buffers are replaced, so a
+   thread that has pinned a buffer under cache_lock can then wait
+   for its lock knowing the buffer still holds the same sector. */
+
+/* Sector number of a buffer that holds no sector. */
+#define NO_SECTOR ((block_sector_t) -1)
+
+/* A cached sector. */
+struct cache_entry
+  {
+    struct hash_elem elem;              /* Element in cache_table. */
+    block_sector_t sector;              /* Sector held, or NO_SECTOR. */
+    int pin_cnt;                        /* Not replaceable while nonzero. */
+    bool accessed;                      /* Used since the clock passed? */
+    bool dirty;                         /* Modified since last written? */
+    bool prefetched;                    /* Read ahead, not yet used? */
+    struct lock lock;                   /* Protects the fields below. */
+    bool valid;                         /* DATA holds the sector? */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+size_t cache_sectors = 64;
+unsigned cache_flush_msecs = 1000;
+size_t cache_readahead_max = 32;
+
+static struct cache_entry *entries;     /* All the buffers. */
+static struct hash cache_table;         /* Buffers in use, by sector. */
+static size_t clock_hand;               /* Next buffer to consider. */
+static struct lock cache_lock;          /* See above. */
+static struct condition cache_unpinned; /* Signaled when pin_cnt drops. */
+static size_t dirty_cnt;                /* # of dirty buffers. */
+
+/* Serializes cache_flush(), which uses flush_list. */
+static struct lock flush_lock;
+static struct cache_entry **flush_list;
+
+/* Sectors waiting to be read ahead, in a circular queue. */
+#define RA_QUEUE_SIZE 64
+static block_sector_t ra_queue[RA_QUEUE_SIZE];
+static size_t ra_head, ra_cnt;
+static struct lock ra_lock;
+static struct condition ra_nonempty;
+
+/* Statistics. */
+static long long hit_cnt;               /* # of lookups found cached. */
+static long long miss_cnt;              /* # of lookups not cached. */
+static long long write_cnt;             /* # of sectors written back. */
+static long long flush_cnt;             /* # of flushes. */
+static long long ra_reads;              /* # of sectors read ahead. */
+static long long ra_used;               /* # of those used since. */
+static long long ra_dropped;            /* # not queued, queue full. */
+
+static unsigned entry_hash (const struct hash_elem *, void *);
+static bool entry_less (const struct hash_elem *, const struct hash_elem *,
+                        void *);
+static struct cache_entry *cache_get (block_sector_t, bool read,
+                                      bool prefetch);
+static void cache_put (struct cache_entry *, bool dirtied);
+static void write_back (struct cache_entry *);
+static thread_func flush_thread NO_RETURN;
+static thread_func readahead_thread NO_RETURN;
+static int sector_compare (const void *, const void *);
+
+/* Initializes the cache. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  if (cache_sectors < 1)
+    cache_sectors = 1;
+  entries = malloc (cache_sectors * sizeof *entries);
+  flush_list = malloc (cache_sectors * sizeof *flush_list);
+  if (entries == NULL || flush_list == NULL
+      || !hash_init (&cache_table, entry_hash, entry_less, NULL))
+    PANIC ("can't allocate %zu-sector buffer cache", cache_sectors);
+  for (i = 0; i < cache_sectors; i++)
+    {
+      struct cache_entry *e = &entries[i];
+      e->sector = NO_SECTOR;
+      e->pin_cnt = 0;
+      e->accessed = false;
+      e->dirty = false;
+      e->prefetched = false;
+      lock_init (&e->lock);
+      e->valid = false;
+    }
+  lock_init (&cache_lock);
+  cond_init (&cache_unpinned);
+  lock_init (&flush_lock);
+  lock_init (&ra_lock);
+  cond_init (&ra_nonempty);
+  if (cache_flush_msecs > 0)
+    thread_create ("fs-flush", PRI_DEFAULT, flush_thread, NULL);
+  if (cache_readahead_max > 0)
+    thread_create ("fs-readahead", PRI_DEFAULT, readahead_thread, NULL);
+}
+
+/* Reads SECTOR into BUFFER, which must be BLOCK_SECTOR_SIZE
+   bytes long. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes starting at byte offset OFS within SECTOR into
+   BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, size_t ofs, size_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true, false);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e, false);
+}
+
+/* Writes BUFFER, which must be BLOCK_SECTOR_SIZE bytes long, to
+   SECTOR. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR starting at byte
+   offset OFS.  The rest of the sector is read from disk first
+   unless the whole sector is written.  The write reaches the
+   disk later, unless cache_flush_msecs is 0. */
+void
+cache_write_at (block_sector_t sector, const void *buffer,
+                size_t ofs, size_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE, false);
+  memcpy (e->data + ofs, buffer, size);
+  e->valid = true;
+  cache_put (e, true);
+}
+
+/* Fills SECTOR with zeros. */
+void
+cache_zero (block_sector_t sector)
+{
+  struct cache_entry *e = cache_get (sector, false, false);
+  memset (e->data, 0, BLOCK_SECTOR_SIZE);
+  e->valid = true;
+  cache_put (e, true);
+}
+
+/* Queues SECTOR to be read into the cache in the background, if
+   readahead is enabled and the queue has room. */
+void
+cache_readahead (block_sector_t sector)
+{
+  if (cache_readahead_max == 0)
+    return;
+
+  lock_acquire (&ra_lock);
+  if (ra_cnt < RA_QUEUE_SIZE)
+    {
+      ra_queue[(ra_head + ra_cnt++) % RA_QUEUE_SIZE] = sector;
+      cond_signal (&ra_nonempty, &ra_lock);
+    }
+  else
+    ra_dropped++;
+  lock_release (&ra_lock);
+}
+
+/* Writes all dirty buffers to disk, in order of sector number. */
+void
+cache_flush (void)
+{
+  size_t cnt, i;
+
+  lock_acquire (&flush_lock);
+
+  /* Pin the dirty buffers, so that they keep their sectors. */
+  lock_acquire (&cache_lock);
+  cnt = 0;
+  for (i = 0; i < cache_sectors; i++)
+    if (entries[i].dirty)
+      {
+        entries[i].pin_cnt++;
+        flush_list[cnt++] = &entries[i];
+      }
+  lock_release (&cache_lock);
+
+  qsort (flush_list, cnt, sizeof *flush_list, sector_compare);
+  for (i = 0; i < cnt; i++)
+    {
+      struct cache_entry *e = flush_list[i];
+      lock_acquire (&e->lock);
+      write_back (e);
+      cache_put (e, false);
+    }
+  flush_cnt++;
+
+  lock_release (&flush_lock);
+}
+
+/* Writes all dirty buffers to disk at shutdown, unless that is
+   impossible because the kernel is panicking with interrupts off
+   or inside the cache itself. */
+void
+cache_shutdown (void)
+{
+  size_t i;
+
+  if (entries == NULL || intr_get_level () == INTR_OFF
+      || lock_held_by_current_thread (&cache_lock)
+      || lock_held_by_current_thread (&flush_lock))
+    return;
+  for (i = 0; i < cache_sectors; i++)
+    if (lock_held_by_current_thread (&entries[i].lock))
+      return;
+  cache_flush ();
+}
+
+/* Prints cache statistics. */
+void
+cache_print_stats (void)
+{
+  if (entries == NULL)
+    return;
+  printf ("Cache: %lld hits, %lld misses, %zu sectors\n",
+          hit_cnt, miss_cnt, cache_sectors);
+  printf ("Cache: %lld sectors written back in %lld flushes\n",
+          write_cnt, flush_cnt);
+  if (cache_readahead_max > 0)
+    printf ("Cache: %lld sectors read ahead, %lld used, %lld dropped\n",
+            ra_reads, ra_used, ra_dropped);
+}
+
+/* Returns the buffer for SECTOR, pinned and locked, reading the
+   sector into it from disk if READ is true and it is not there
+   already.  Replaces another sector's buffer if SECTOR is not
+   cached, waiting for one to be unpinned if necessary.
+   PREFETCH is true for readahead, which is not counted as a hit
+   or a miss. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool read, bool prefetch)
+{
+  struct cache_entry key, *e;
+  struct hash_elem *found;
+
+  ASSERT (sector != NO_SECTOR);
+
+ retry:
+  lock_acquire (&cache_lock);
+  key.sector = sector;
+  found = hash_find (&cache_table, &key.elem);
+  if (found != NULL)
+    e = hash_entry (found, struct cache_entry, elem);
+  else
+    {
+      /* Clock: skip pinned buffers, give recently used ones a
+         second chance. */
+      size_t scanned;
+
+      for (scanned = 0; ; scanned++)
+        {
+          if (scanned >= 2 * cache_sectors)
+            {
+              cond_wait (&cache_unpinned, &cache_lock);
+              scanned = 0;
+
+              /* Someone else may have brought the sector in. */
+              found = hash_find (&cache_table, &key.elem);
+              if (found != NULL)
+                break;
+            }
+          e = &entries[clock_hand];
+          clock_hand = (clock_hand + 1) % cache_sectors;
+          if (e->pin_cnt > 0)
+            continue;
+          if (e->accessed)
+            e->accessed = false;
+          else
+            break;
+        }
+
+      if (found != NULL)
+        e = hash_entry (found, struct cache_entry, elem);
+      else if (e->dirty)
+        {
+          /* Write the victim back, pinned so that it keeps its
+             sector meanwhile, then start over. */
+          e->pin_cnt++;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          write_back (e);
+          cache_put (e, false);
+          goto retry;
+        }
+      else
+        {
+          if (e->sector != NO_SECTOR)
+            hash_delete (&cache_table, &e->elem);
+          e->sector = sector;
+          e->valid = false;
+          e->prefetched = false;
+          hash_insert (&cache_table, &e->elem);
+        }
+    }
+  if (prefetch)
+    {
+      if (found == NULL)
+        {
+          e->prefetched = true;
+          ra_reads++;
+        }
+    }
+  else
+    {
+      if (found != NULL)
+        hit_cnt++;
+      else
+        miss_cnt++;
+      if (e->prefetched)
+        {
+          e->prefetched = false;
+          ra_used++;
+        }
+    }
+  e->pin_cnt++;
+  e->accessed = true;
+  lock_release (&cache_lock);
+
+  lock_acquire (&e->lock);
+  if (read && !e->valid)
+    {
+      block_read (fs_device, sector, e->data);
+      e->valid = true;
+    }
+  return e;
+}
+
+/* Unlocks and unpins E, obtained from cache_get(), marking it
+   dirty if DIRTIED is true. */
+static void
+cache_put (struct cache_entry *e, bool dirtied)
+{
+  if (dirtied && cache_flush_msecs == 0)
+    {
+      block_write (fs_device, e->sector, e->data);
+      write_cnt++;
+      dirtied = false;
+    }
+  lock_release (&e->lock);
+
+  lock_acquire (&cache_lock);
+  if (dirtied && !e->dirty)
+    {
+      e->dirty = true;
+      dirty_cnt++;
+    }
+  if (--e->pin_cnt == 0)
+    cond_signal (&cache_unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Writes E to disk if it is dirty.  The caller must hold E's
+   lock and have E pinned. */
+static void
+write_back (struct cache_entry *e)
+{
+  bool dirty;
+
+  ASSERT (lock_held_by_current_thread (&e->lock));
+  ASSERT (e->pin_cnt > 0);
+
+  /* A write that dirties E again after this point will take E's
+     lock after we release it, so it is never lost. */
+  lock_acquire (&cache_lock);
+  dirty = e->dirty;
+  if (dirty)
+    {
+      e->dirty = false;
+      dirty_cnt--;
+    }
+  lock_release (&cache_lock);
+
+  if (dirty)
+    {
+      block_write (fs_device, e->sector, e->data);
+      write_cnt++;
+    }
+}
+
+/* Flushes the cache every cache_flush_msecs, or sooner if half
+   of it is dirty. */
+static void
+flush_thread (void *aux UNUSED)
+{
+  const int64_t poll = 50;
+  int64_t waited = 0;
+
+  for (;;)
+    {
+      timer_msleep (poll);
+      waited += poll;
+      if (waited >= cache_flush_msecs || dirty_cnt >= cache_sectors / 2)
+        {
+          cache_flush ();
+          waited = 0;
+        }
+    }
+}
+
+/* Reads queued sectors into the cache. */
+static void
+readahead_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sector;
+
+      lock_acquire (&ra_lock);
+      while (ra_cnt == 0)
+        cond_wait (&ra_nonempty, &ra_lock);
+      sector = ra_queue[ra_head];
+      ra_head = (ra_head + 1) % RA_QUEUE_SIZE;
+      ra_cnt--;
+      lock_release (&ra_lock);
+
+      cache_put (cache_get (sector, true, true), false);
+    }
+}
+
+/* Orders pointers to cache entries by sector number. */
+static int
+sector_compare (const void *a_, const void *b_)
+{
+  const struct cache_entry *const *a = a_;
+  const struct cache_entry *const *b = b_;
+  return (*a)->sector < (*b)->sector ? -1 : (*a)->sector > (*b)->sector;
+}
+
+/* Returns a hash value for the cache entry containing E. */
+static unsigned
+entry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct cache_entry *ce = hash_entry (e, struct cache_entry, elem);
+  return hash_int (ce->sector);
+}
+
+/* Returns true if cache entry A's sector is less than B's. */
+static bool
+entry_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  const struct cache_entry *ca = hash_entry (a, struct cache_entry, elem);
+  const struct cache_entry *cb = hash_entry (b, struct cache_entry, elem);
+  return ca->sector < cb->sector;
+}
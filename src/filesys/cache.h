@@ -0,0 +1,31 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Number of sectors in the cache.
+   Controlled by kernel command-line option "-cache". */
+extern size_t cache_sectors;
+
+/* Interval between writes of dirty sectors, in milliseconds, or
+   0 to write through.
+   Controlled by kernel command-line option "-flush". */
+extern unsigned cache_flush_msecs;
+
+/* Largest readahead window, in sectors, or 0 to disable.
+   Controlled by kernel command-line option "-ra". */
+extern size_t cache_readahead_max;
+
+void cache_init (void);
+void cache_read (block_sector_t, void *);
+void cache_read_at (block_sector_t, void *, size_t ofs, size_t size);
+void cache_write (block_sector_t, const void *);
+void cache_write_at (block_sector_t, const void *, size_t ofs, size_t size);
+void cache_zero (block_sector_t);
+void cache_readahead (block_sector_t);
+void cache_flush (void);
+void cache_shutdown (void);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
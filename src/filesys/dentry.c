@@ -0,0 +1,183 @@
+#include "filesys/dentry.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* The directory entry cache maps a directory and a name in it to
+   the sector of the named inode, for the names most recently
+   looked up or added, so that resolving a path seldom reads the
+   directories along the way.
+
+   A directory's entries are only added to the cache, and removed
+   from it, with the directory's lock held, which keeps them in
+   step with the directory on disk.  A directory is empty when it
+   is removed, so no entries are left for its sector when that is
+   reused. */
+
+/* A cached directory entry. */
+struct dentry
+  {
+    struct hash_elem elem;              /* Element in dentries. */
+    struct list_elem lru_elem;          /* Element in lru. */
+    block_sector_t dir;                 /* Directory's inode sector. */
+    block_sector_t sector;              /* Named inode's sector. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+  };
+
+/* Most entries to cache. */
+#define DENTRY_MAX 512
+
+static struct hash dentries;            /* Cached entries. */
+static struct list lru;                 /* Cached entries, oldest first. */
+static size_t dentry_cnt;               /* Number of cached entries. */
+static struct lock dentry_lock;         /* Protects all of the above. */
+
+/* Statistics. */
+static long long hit_cnt;               /* # of lookups found. */
+static long long miss_cnt;              /* # of lookups not found. */
+
+static struct dentry *find (block_sector_t dir, const char *name);
+static hash_hash_func dentry_hash;
+static hash_less_func dentry_less;
+
+/* Initializes the directory entry cache. */
+void
+dentry_init (void) 
+{
+  if (!hash_init (&dentries, dentry_hash, dentry_less, NULL))
+    PANIC ("can't allocate directory entry cache");
+  list_init (&lru);
+  lock_init (&dentry_lock);
+}
+
+/* Looks up NAME in the directory whose inode is in sector DIR.
+   If it is cached, stores the sector of its inode into *SECTORP
+   and returns true; otherwise, returns false. */
+bool
+dentry_lookup (block_sector_t dir, const char *name, block_sector_t *sectorp)
+{
+  struct dentry *d;
+
+  lock_acquire (&dentry_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      list_remove (&d->lru_elem);
+      list_push_back (&lru, &d->lru_elem);
+      *sectorp = d->sector;
+      hit_cnt++;
+    }
+  else
+    miss_cnt++;
+  lock_release (&dentry_lock);
+  return d != NULL;
+}
+
+/* Caches NAME, whose inode is in SECTOR, as an entry of the
+   directory whose inode is in sector DIR, replacing the least
+   recently used entry if the cache is full.  The caller must
+   hold the directory's lock.  Does nothing if memory is short. */
+void
+dentry_add (block_sector_t dir, const char *name, block_sector_t sector) 
+{
+  struct dentry *d;
+
+  ASSERT (strlen (name) <= NAME_MAX);
+
+  lock_acquire (&dentry_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      list_remove (&d->lru_elem);
+      hash_delete (&dentries, &d->elem);
+      dentry_cnt--;
+    }
+  else if (dentry_cnt >= DENTRY_MAX)
+    {
+      d = list_entry (list_pop_front (&lru), struct dentry, lru_elem);
+      hash_delete (&dentries, &d->elem);
+      dentry_cnt--;
+    }
+  else
+    d = malloc (sizeof *d);
+
+  if (d != NULL)
+    {
+      d->dir = dir;
+      d->sector = sector;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentries, &d->elem);
+      list_push_back (&lru, &d->lru_elem);
+      dentry_cnt++;
+    }
+  lock_release (&dentry_lock);
+}
+
+/* Removes NAME in the directory whose inode is in sector DIR from
+   the cache, if it is there.  The caller must hold the
+   directory's lock. */
+void
+dentry_remove (block_sector_t dir, const char *name) 
+{
+  struct dentry *d;
+
+  lock_acquire (&dentry_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      list_remove (&d->lru_elem);
+      hash_delete (&dentries, &d->elem);
+      dentry_cnt--;
+      free (d);
+    }
+  lock_release (&dentry_lock);
+}
+
+/* Prints directory entry cache statistics. */
+void
+dentry_print_stats (void) 
+{
+  printf ("Dentry cache: %lld hits, %lld misses\n", hit_cnt, miss_cnt);
+}
+
+/* Returns the cached entry for NAME in the directory whose inode
+   is in sector DIR, or a null pointer if there is none.  The
+   caller must hold dentry_lock. */
+static struct dentry *
+find (block_sector_t dir, const char *name) 
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.elem);
+  return e != NULL ? hash_entry (e, struct dentry, elem) : NULL;
+}
+
+/* Returns a hash value for the entry containing E. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, elem);
+  return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+/* Returns true if entry A precedes B. */
+static bool
+dentry_less (const struct hash_elem *a, const struct hash_elem *b,
+             void *aux UNUSED)
+{
+  const struct dentry *da = hash_entry (a, struct dentry, elem);
+  const struct dentry *db = hash_entry (b, struct dentry, elem);
+  if (da->dir != db->dir)
+    return da->dir < db->dir;
+  return strcmp (da->name, db->name) < 0;
+}
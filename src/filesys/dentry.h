@@ -0,0 +1,14 @@
+#ifndef FILESYS_DENTRY_H
+#define FILESYS_DENTRY_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+void dentry_init (void);
+bool dentry_lookup (block_sector_t dir, const char *name,
+                    block_sector_t *sectorp);
+void dentry_add (block_sector_t dir, const char *name, block_sector_t);
+void dentry_remove (block_sector_t dir, const char *name);
+void dentry_print_stats (void);
+
+#endif /* filesys/dentry.h */
@@ -1,12 +1,20 @@
 #include "filesys/directory.h"
+#include <debug.h>
+#include <hash.h>
+#include <round.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
-#include <list.h>
+#include "filesys/dentry.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
-/* A directory. */
+/* A directory.
+
+   Each directory's entries are looked up and updated only with
+   its inode's directory lock held (see inode_lock_dir()), so
+   operations on different directories proceed in parallel. */
 struct dir 
   {
     struct inode *inode;                /* Backing store. */
@@ -21,21 +29,116 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
-/* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+/* A directory file is a hash table of entries, which grows by
+   linear hashing so that finding a name reads a sector or two
+   however many entries there are.
+
+   The entries are kept in buckets of one sector each.  Bucket B
+   holds the names that hash to B, modulo BASE_CNT << LEVEL
+   buckets, or twice that many for buckets before SPLIT, which
+   have already been split in the current round.  A full bucket
+   continues in a chain of overflow buckets.  When the entries
+   fill 3/4 of the buckets, bucket SPLIT is split, moving about
+   half of its entries into a new bucket, and SPLIT advances; the
+   round ends when the number of buckets has doubled.
+
+   Sector 0 of the file holds the header below.  The buckets can
+   be anywhere in the file, so map blocks, named by the header,
+   give each bucket's sector.  Sector numbers here count sectors
+   of the directory file, not of the disk, and 0 stands for none.
+
+   A new directory is all zeros: a header, one map block, and its
+   first buckets, which are set up on first use.  That way
+   creating one cannot fail once its inode exists. */
+
+/* Identifies a directory header. */
+#define DIR_MAGIC 0x44495248
+
+/* Number of entries in a bucket. */
+#define BUCKET_ENTRIES 25
+
+/* Number of buckets named by a map block. */
+#define BUCKETS_PER_MAP (BLOCK_SECTOR_SIZE / sizeof (uint32_t))
+
+/* Number of map blocks named by the header. */
+#define MAP_CNT 121
+
+/* Directory header, in sector 0 of a directory file.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct dir_header
+  {
+    uint32_t magic;                     /* DIR_MAGIC. */
+    uint32_t base_cnt;                  /* Buckets before any split. */
+    uint32_t level;                     /* Rounds of splits completed. */
+    uint32_t split;                     /* Next bucket to split. */
+    uint32_t entry_cnt;                 /* Entries in use. */
+    uint32_t sector_cnt;                /* Sectors of the file in use. */
+    uint32_t free_sector;               /* First free sector, or 0. */
+    uint32_t maps[MAP_CNT];             /* Map blocks. */
+  };
+
+/* A bucket, or a free sector if FREE is nonzero.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct dir_bucket
+  {
+    uint32_t next;                      /* Next in chain or free list. */
+    uint32_t free;                      /* Nonzero if free. */
+    struct dir_entry entries[BUCKET_ENTRIES];
+    uint32_t unused;                    /* Not used. */
+  };
+
+/* State kept in memory for each directory inode: its header and
+   a scratch bucket.  Both are protected by the inode's directory
+   lock.  Names recently looked up are cached in the directory
+   entry cache (see dentry.c). */
+struct dir_cache
+  {
+    struct dir_header header;           /* Copy of the header. */
+    struct dir_bucket bucket;           /* Scratch bucket. */
+  };
+
+/* Statistics. */
+static long long lookup_cnt;            /* # of names looked up. */
+static long long read_cnt;              /* # of directory sectors read. */
+
+static bool read_sector (struct inode *, uint32_t sec, void *);
+static bool write_sector (struct inode *, uint32_t sec, const void *);
+static bool write_header (struct inode *, struct dir_cache *);
+static size_t bucket_cnt (const struct dir_header *);
+static bool is_map (const struct dir_header *, uint32_t sec);
+static bool alloc_sector (struct inode *, struct dir_cache *, uint32_t *);
+static struct dir_cache *get_cache (struct inode *);
+static bool search (struct inode *, struct dir_cache *, const char *name,
+                    uint32_t *secp, int *slotp);
+static void split (struct inode *, struct dir_cache *);
+
+/* Creates a directory with buckets for ENTRY_CNT entries in the
+   given SECTOR, as a subdirectory of the directory whose inode is
+   in sector PARENT.  The root directory is its own parent.
+   Returns true if successful, false on failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, size_t entry_cnt, block_sector_t parent)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  size_t bucket_cnt = DIV_ROUND_UP (entry_cnt, BUCKET_ENTRIES);
+
+  ASSERT (sizeof (struct dir_header) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct dir_bucket) == BLOCK_SECTOR_SIZE);
+
+  if (bucket_cnt < 1)
+    bucket_cnt = 1;
+  else if (bucket_cnt > BUCKETS_PER_MAP)
+    bucket_cnt = BUCKETS_PER_MAP;
+  return inode_create (sector, (2 + bucket_cnt) * BLOCK_SECTOR_SIZE, parent);
 }
 
 /* Opens and returns the directory for the given INODE, of which
-   it takes ownership.  Returns a null pointer on failure. */
+   it takes ownership.  Returns a null pointer on failure,
+   including if INODE is not a directory. */
 struct dir *
 dir_open (struct inode *inode) 
 {
   struct dir *dir = calloc (1, sizeof *dir);
-  if (inode != NULL && dir != NULL)
+  if (inode != NULL && dir != NULL && inode_is_dir (inode))
     {
       dir->inode = inode;
       dir->pos = 0;
@@ -83,51 +186,48 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
-   If successful, returns true, sets *EP to the directory entry
-   if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
-static bool
-lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
-{
-  struct dir_entry e;
-  size_t ofs;
-  
-  ASSERT (dir != NULL);
-  ASSERT (name != NULL);
-
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
-  return false;
-}
-
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   "." names DIR itself and ".." its parent directory.  A
+   directory that has been removed has neither. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
-  struct dir_entry e;
+  block_sector_t dir_sector, inode_sector;
+  struct dir_cache *dc;
+  uint32_t sec;
+  int slot;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  dir_sector = inode_get_inumber (dir->inode);
+  *inode = NULL;
+  inode_lock_dir (dir->inode);
+  lookup_cnt++;
+  if (!inode_is_removed (dir->inode))
+    {
+      if (!strcmp (name, "."))
+        *inode = inode_reopen (dir->inode);
+      else if (!strcmp (name, ".."))
+        *inode = inode_open (inode_get_parent (dir->inode));
+      else if (dentry_lookup (dir_sector, name, &inode_sector))
+        *inode = inode_open (inode_sector);
+      else
+        {
+          dc = get_cache (dir->inode);
+          if (dc != NULL && search (dir->inode, dc, name, &sec, &slot))
+            {
+              inode_sector = dc->bucket.entries[slot].inode_sector;
+              dentry_add (dir_sector, name, inode_sector);
+              *inode = inode_open (inode_sector);
+            }
+        }
+    }
+  inode_unlock_dir (dir->inode);
 
   return *inode != NULL;
 }
@@ -136,81 +236,133 @@ dir_lookup (const struct dir *dir, const char *name,
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
-   Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   Fails if NAME is invalid (i.e. too long, "." or ".."), if DIR
+   has been removed, or if a disk or memory error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
-  struct dir_entry e;
-  off_t ofs;
+  struct dir_cache *dc;
+  struct dir_entry *e;
+  uint32_t sec;
+  int slot;
   bool success = false;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
   /* Check NAME for validity. */
-  if (*name == '\0' || strlen (name) > NAME_MAX)
+  if (*name == '\0' || strlen (name) > NAME_MAX
+      || !strcmp (name, ".") || !strcmp (name, ".."))
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  inode_lock_dir (dir->inode);
+  dc = get_cache (dir->inode);
+
+  /* Check that NAME is not in use, and find a free slot in its
+     bucket. */
+  if (dc == NULL || inode_is_removed (dir->inode)
+      || search (dir->inode, dc, name, &sec, &slot))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  /* If the bucket is full, chain a new overflow bucket to it,
+     unless the search could not read the chain. */
+  if (slot < 0)
+    {
+      uint32_t last = sec;
+      if (last == 0 || !alloc_sector (dir->inode, dc, &sec))
+        goto done;
+      if (!read_sector (dir->inode, last, &dc->bucket))
+        goto done;
+      dc->bucket.next = sec;
+      if (!write_sector (dir->inode, last, &dc->bucket))
+        goto done;
+      memset (&dc->bucket, 0, sizeof dc->bucket);
+      slot = 0;
+    }
 
   /* Write slot. */
-  e.in_use = true;
-  strlcpy (e.name, name, sizeof e.name);
-  e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  e = &dc->bucket.entries[slot];
+  e->in_use = true;
+  strlcpy (e->name, name, sizeof e->name);
+  e->inode_sector = inode_sector;
+  if (!write_sector (dir->inode, sec, &dc->bucket))
+    goto done;
+  dc->header.entry_cnt++;
+  success = write_header (dir->inode, dc);
+  dentry_add (inode_get_inumber (dir->inode), name, inode_sector);
+
+  /* Grow the table if it is getting full. */
+  if (dc->header.entry_cnt * 4 > bucket_cnt (&dc->header) * BUCKET_ENTRIES * 3)
+    split (dir->inode, dc);
 
  done:
+  inode_unlock_dir (dir->inode);
   return success;
 }
 
 /* Removes any entry for NAME in DIR.
    Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   which occurs only if there is no file with the given NAME or
+   it is a directory that is not empty. */
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
-  struct dir_entry e;
+  struct dir_cache *dc;
+  struct dir_entry *e;
   struct inode *inode = NULL;
   bool success = false;
-  off_t ofs;
+  uint32_t sec;
+  int slot;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  inode_lock_dir (dir->inode);
+
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  dc = get_cache (dir->inode);
+  if (dc == NULL || !search (dir->inode, dc, name, &sec, &slot))
     goto done;
+  e = &dc->bucket.entries[slot];
 
   /* Open inode. */
-  inode = inode_open (e.inode_sector);
+  inode = inode_open (e->inode_sector);
   if (inode == NULL)
     goto done;
 
+  /* A directory must be empty.  Its lock, taken after its
+     parent's, is held until it is marked removed, so that nothing
+     can be added to it in between. */
+  if (inode_is_dir (inode))
+    {
+      struct dir_cache *child;
+
+      inode_lock_dir (inode);
+      child = get_cache (inode);
+      if (child == NULL || child->header.entry_cnt > 0)
+        {
+          inode_unlock_dir (inode);
+          goto done;
+        }
+    }
+
   /* Erase directory entry. */
-  e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
-    goto done;
+  e->in_use = false;
+  dentry_remove (inode_get_inumber (dir->inode), name);
+  if (write_sector (dir->inode, sec, &dc->bucket))
+    {
+      dc->header.entry_cnt--;
+      write_header (dir->inode, dc);
 
-  /* Remove inode. */
-  inode_remove (inode);
-  success = true;
+      /* Remove inode. */
+      inode_remove (inode);
+      success = true;
+    }
+  if (inode_is_dir (inode))
+    inode_unlock_dir (inode);
 
  done:
+  inode_unlock_dir (dir->inode);
   inode_close (inode);
   return success;
 }
@@ -221,16 +373,432 @@ dir_remove (struct dir *dir, const char *name)
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
-  struct dir_entry e;
+  struct dir_cache *dc;
+  bool found = false;
+
+  /* DIR->pos is the number of the next slot to read, counting
+     BUCKET_ENTRIES slots in each sector of the file.  Sectors
+     that are not buckets are skipped. */
+  inode_lock_dir (dir->inode);
+  dc = get_cache (dir->inode);
+  if (dc != NULL && dir->pos < BUCKET_ENTRIES)
+    dir->pos = BUCKET_ENTRIES;
+  while (dc != NULL && !found
+         && (uint32_t) dir->pos / BUCKET_ENTRIES < dc->header.sector_cnt)
+    {
+      uint32_t sec = dir->pos / BUCKET_ENTRIES;
+      int slot = dir->pos % BUCKET_ENTRIES;
+
+      if (is_map (&dc->header, sec)
+          || !read_sector (dir->inode, sec, &dc->bucket)
+          || dc->bucket.free)
+        {
+          dir->pos = (sec + 1) * BUCKET_ENTRIES;
+          continue;
+        }
+      for (; slot < BUCKET_ENTRIES; slot++)
+        {
+          struct dir_entry *e = &dc->bucket.entries[slot];
+          if (e->in_use)
+            {
+              strlcpy (name, e->name, NAME_MAX + 1);
+              found = true;
+              slot++;
+              break;
+            }
+        }
+      dir->pos = sec * BUCKET_ENTRIES + slot;
+    }
+  inode_unlock_dir (dir->inode);
+  return found;
+}
+
+/* Sets DIR's position for dir_readdir() to POS, which must have
+   been returned by dir_tell(). */
+void
+dir_seek (struct dir *dir, off_t pos) 
+{
+  ASSERT (dir != NULL);
+  ASSERT (pos >= 0);
+  dir->pos = pos;
+}
+
+/* Returns DIR's position for dir_readdir(). */
+off_t
+dir_tell (struct dir *dir) 
+{
+  ASSERT (dir != NULL);
+  return dir->pos;
+}
+
+/* Prints directory statistics. */
+void
+dir_print_stats (void) 
+{
+  printf ("Directories: %lld lookups, %lld sectors read\n",
+          lookup_cnt, read_cnt);
+}
+
+/* Reads sector SEC of directory INODE into BUF.
+   Returns true if successful, false on failure. */
+static bool
+read_sector (struct inode *inode, uint32_t sec, void *buf) 
+{
+  read_cnt++;
+  return (inode_read_at (inode, buf, BLOCK_SECTOR_SIZE,
+                         sec * BLOCK_SECTOR_SIZE) == BLOCK_SECTOR_SIZE);
+}
+
+/* Writes BUF to sector SEC of directory INODE, growing it if
+   necessary.  Returns true if successful, false on failure. */
+static bool
+write_sector (struct inode *inode, uint32_t sec, const void *buf) 
+{
+  return (inode_write_at (inode, buf, BLOCK_SECTOR_SIZE,
+                          sec * BLOCK_SECTOR_SIZE) == BLOCK_SECTOR_SIZE);
+}
+
+/* Writes DC's header to directory INODE.
+   Returns true if successful, false on failure. */
+static bool
+write_header (struct inode *inode, struct dir_cache *dc) 
+{
+  return write_sector (inode, 0, &dc->header);
+}
+
+/* Returns the number of buckets in the table described by H. */
+static size_t
+bucket_cnt (const struct dir_header *h) 
+{
+  return ((size_t) h->base_cnt << h->level) + h->split;
+}
+
+/* Returns the bucket for a name with the given HASH in the table
+   described by H. */
+static size_t
+bucket_of (const struct dir_header *h, unsigned hash) 
+{
+  size_t round_cnt = (size_t) h->base_cnt << h->level;
+  size_t bucket = hash % round_cnt;
+  if (bucket < h->split)
+    bucket = hash % (round_cnt * 2);
+  return bucket;
+}
+
+/* Returns true if sector SEC is one of the map blocks named by
+   H. */
+static bool
+is_map (const struct dir_header *h, uint32_t sec) 
+{
+  size_t i;
+
+  for (i = 0; i < MAP_CNT && h->maps[i] != 0; i++)
+    if (h->maps[i] == sec)
+      return true;
+  return false;
+}
+
+/* Returns the sector of BUCKET in directory INODE, or 0 if it
+   cannot be read. */
+static uint32_t
+bucket_sector (struct inode *inode, struct dir_cache *dc, size_t bucket) 
+{
+  uint32_t map = dc->header.maps[bucket / BUCKETS_PER_MAP];
+  uint32_t sec;
+
+  read_cnt++;
+  if (map == 0
+      || inode_read_at (inode, &sec, sizeof sec,
+                        (map * BUCKETS_PER_MAP + bucket % BUCKETS_PER_MAP)
+                        * sizeof sec) != sizeof sec)
+    return 0;
+  return sec;
+}
+
+/* Sets the sector of BUCKET in directory INODE to SEC.  Its map
+   block must exist.  Returns true if successful, false on
+   failure. */
+static bool
+set_bucket_sector (struct inode *inode, struct dir_cache *dc,
+                   size_t bucket, uint32_t sec) 
+{
+  uint32_t map = dc->header.maps[bucket / BUCKETS_PER_MAP];
+
+  ASSERT (map != 0);
+  return (inode_write_at (inode, &sec, sizeof sec,
+                          (map * BUCKETS_PER_MAP + bucket % BUCKETS_PER_MAP)
+                          * sizeof sec) == sizeof sec);
+}
+
+/* Allocates a sector of directory INODE, zeroes it, and stores
+   it into *SECP.  Takes a free sector if there is one, otherwise
+   grows the file.  Does not write the header.
+   Returns true if successful, false on failure. */
+static bool
+alloc_sector (struct inode *inode, struct dir_cache *dc, uint32_t *secp) 
+{
+  static const uint8_t zeros[BLOCK_SECTOR_SIZE];
+  struct dir_header *h = &dc->header;
+  uint32_t sec, next = 0;
+
+  if (h->free_sector != 0)
+    {
+      sec = h->free_sector;
+      if (inode_read_at (inode, &next, sizeof next, sec * BLOCK_SECTOR_SIZE)
+          != sizeof next)
+        return false;
+    }
+  else
+    sec = h->sector_cnt;
+  if (!write_sector (inode, sec, zeros))
+    return false;
+
+  if (h->free_sector != 0)
+    h->free_sector = next;
+  else
+    h->sector_cnt++;
+  *secp = sec;
+  return true;
+}
+
+/* Adds sector SEC of directory INODE to the free list.  Does not
+   write the header.  Uses DC's scratch bucket. */
+static void
+free_sector (struct inode *inode, struct dir_cache *dc, uint32_t sec) 
+{
+  memset (&dc->bucket, 0, sizeof dc->bucket);
+  dc->bucket.next = dc->header.free_sector;
+  dc->bucket.free = 1;
+  if (write_sector (inode, sec, &dc->bucket))
+    dc->header.free_sector = sec;
+}
+
+/* Returns the state kept for directory INODE, reading its header
+   and setting it up if this is its first use.  Returns a null
+   pointer if INODE is not a directory or memory is short.  The
+   caller must hold INODE's directory lock. */
+static struct dir_cache *
+get_cache (struct inode *inode) 
+{
+  struct dir_cache *dc = inode_get_dir_cache (inode);
+  struct dir_header *h;
+
+  if (dc != NULL || !inode_is_dir (inode))
+    return dc;
+
+  dc = malloc (sizeof *dc);
+  if (dc == NULL)
+    return NULL;
+
+  h = &dc->header;
+  if (!read_sector (inode, 0, h))
+    goto fail;
+  if (h->magic == 0)
+    {
+      /* New directory: one map block, then the buckets. */
+      size_t i;
+
+      h->base_cnt = inode_length (inode) / BLOCK_SECTOR_SIZE - 2;
+      if (h->base_cnt < 1 || h->base_cnt > BUCKETS_PER_MAP)
+        goto fail;
+      h->sector_cnt = 2 + h->base_cnt;
+      h->maps[0] = 1;
+      for (i = 0; i < h->base_cnt; i++)
+        if (!set_bucket_sector (inode, dc, i, 2 + i))
+          goto fail;
+      h->magic = DIR_MAGIC;
+      if (!write_header (inode, dc))
+        goto fail;
+    }
+  else if (h->magic != DIR_MAGIC)
+    goto fail;
+
+  inode_set_dir_cache (inode, dc, free);
+  return dc;
+
+ fail:
+  free (dc);
+  return NULL;
+}
+
+/* Searches the bucket for NAME in directory INODE.  Leaves the
+   last bucket read in DC's scratch bucket and its sector in
+   *SECP.
+   If NAME is found, returns true and sets *SLOTP to its slot.
+   Otherwise, returns false and sets *SLOTP to the first free
+   slot, or to -1 if the bucket and its overflow buckets are all
+   full, in which case *SECP is the last of them.  Returns false
+   with *SECP set to 0 on failure to read. */
+static bool
+search (struct inode *inode, struct dir_cache *dc, const char *name,
+        uint32_t *secp, int *slotp) 
+{
+  uint32_t sec = bucket_sector (inode, dc,
+                                bucket_of (&dc->header, hash_string (name)));
+  uint32_t free_sec = 0;
+  int free_slot = -1;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  *secp = 0;
+  *slotp = -1;
+  while (sec != 0)
     {
-      dir->pos += sizeof e;
-      if (e.in_use)
+      int slot;
+
+      if (!read_sector (inode, sec, &dc->bucket))
         {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        } 
+          *secp = 0;
+          return false;
+        }
+      for (slot = 0; slot < BUCKET_ENTRIES; slot++)
+        {
+          struct dir_entry *e = &dc->bucket.entries[slot];
+          if (e->in_use && !strcmp (name, e->name))
+            {
+              *secp = sec;
+              *slotp = slot;
+              return true;
+            }
+          else if (!e->in_use && free_slot < 0)
+            {
+              free_sec = sec;
+              free_slot = slot;
+            }
+        }
+      *secp = sec;
+      sec = dc->bucket.next;
+    }
+
+  if (free_slot >= 0)
+    {
+      /* Leave the bucket with the free slot in the scratch
+         bucket. */
+      if (free_sec != *secp && !read_sector (inode, free_sec, &dc->bucket))
+        {
+          *secp = 0;
+          return false;
+        }
+      *secp = free_sec;
+      *slotp = free_slot;
     }
   return false;
 }
+
+/* Splits the next bucket of directory INODE, moving the entries
+   that belong in the new bucket into it, if there is room for a
+   new bucket.  On failure, the table is left as it was. */
+static void
+split (struct inode *inode, struct dir_cache *dc) 
+{
+  struct dir_header *h = &dc->header;
+  size_t round_cnt = (size_t) h->base_cnt << h->level;
+  size_t old = h->split, new = old + round_cnt;
+  struct dir_entry *entries = NULL;
+  uint32_t *secs = NULL;
+  size_t entry_cnt = 0, sec_cnt = 0, move_cnt, stay_cnt, new_cnt;
+  size_t i;
+  uint32_t sec;
+
+  /* Make sure the new bucket's map block exists. */
+  if (new / BUCKETS_PER_MAP >= MAP_CNT)
+    return;
+  if (h->maps[new / BUCKETS_PER_MAP] == 0)
+    {
+      if (!alloc_sector (inode, dc, &sec))
+        return;
+      h->maps[new / BUCKETS_PER_MAP] = sec;
+    }
+
+  /* Read the old bucket's chain, putting the entries that move
+     first. */
+  for (sec = bucket_sector (inode, dc, old); sec != 0; sec = dc->bucket.next)
+    {
+      uint32_t *new_secs = realloc (secs, (sec_cnt + 1) * sizeof *secs);
+      struct dir_entry *new_entries
+        = realloc (entries, (entry_cnt + BUCKET_ENTRIES) * sizeof *entries);
+      if (new_secs != NULL)
+        secs = new_secs;
+      if (new_entries != NULL)
+        entries = new_entries;
+      if (new_secs == NULL || new_entries == NULL
+          || !read_sector (inode, sec, &dc->bucket))
+        goto done;
+      secs[sec_cnt++] = sec;
+      for (i = 0; i < BUCKET_ENTRIES; i++)
+        if (dc->bucket.entries[i].in_use)
+          entries[entry_cnt++] = dc->bucket.entries[i];
+    }
+  if (sec_cnt == 0)
+    goto done;
+  move_cnt = 0;
+  for (i = 0; i < entry_cnt; i++)
+    if (hash_string (entries[i].name) % (round_cnt * 2) == new)
+      {
+        struct dir_entry tmp = entries[move_cnt];
+        entries[move_cnt++] = entries[i];
+        entries[i] = tmp;
+      }
+  stay_cnt = entry_cnt - move_cnt;
+
+  /* Write the new bucket and its overflow buckets, last first, so
+     that nothing changes unless all of them can be written. */
+  new_cnt = move_cnt > 0 ? DIV_ROUND_UP (move_cnt, BUCKET_ENTRIES) : 1;
+  sec = 0;
+  for (i = new_cnt; i-- > 0; )
+    {
+      size_t first = i * BUCKET_ENTRIES;
+      size_t cnt = move_cnt - first < BUCKET_ENTRIES ? move_cnt - first
+                                                     : BUCKET_ENTRIES;
+      uint32_t next = sec;
+
+      if (!alloc_sector (inode, dc, &sec))
+        {
+          /* Give back what was allocated. */
+          for (sec = next; sec != 0; sec = next)
+            {
+              if (!read_sector (inode, sec, &dc->bucket))
+                break;
+              next = dc->bucket.next;
+              free_sector (inode, dc, sec);
+            }
+          goto done;
+        }
+      memset (&dc->bucket, 0, sizeof dc->bucket);
+      dc->bucket.next = next;
+      memcpy (dc->bucket.entries, entries + first, cnt * sizeof *entries);
+      if (!write_sector (inode, sec, &dc->bucket))
+        goto done;
+    }
+  if (!set_bucket_sector (inode, dc, new, sec))
+    goto done;
+
+  /* Rewrite the old chain with the entries that stay, freeing the
+     overflow buckets no longer needed. */
+  for (i = 0; i < sec_cnt; i++)
+    {
+      size_t first = i * BUCKET_ENTRIES;
+      if (i > 0 && first >= stay_cnt)
+        free_sector (inode, dc, secs[i]);
+      else
+        {
+          size_t cnt = stay_cnt - first < BUCKET_ENTRIES ? stay_cnt - first
+                                                         : BUCKET_ENTRIES;
+          memset (&dc->bucket, 0, sizeof dc->bucket);
+          if (first + BUCKET_ENTRIES < stay_cnt)
+            dc->bucket.next = secs[i + 1];
+          memcpy (dc->bucket.entries, entries + move_cnt + first,
+                  cnt * sizeof *entries);
+          write_sector (inode, secs[i], &dc->bucket);
+        }
+    }
+
+  if (++h->split == round_cnt)
+    {
+      h->level++;
+      h->split = 0;
+    }
+
+ done:
+  write_header (inode, dc);
+  free (entries);
+  free (secs);
+}
@@ -1,5 +1,7 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include "devices/block.h"
+#include "filesys/cache.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
@@ -15,6 +17,9 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = 0;
+      file->ra_end = 0;
+      file->ra_window = 0;
       return file;
     }
   else
@@ -56,12 +61,42 @@ file_get_inode (struct file *file)
    starting at the file's current position.
    Returns the number of bytes actually read,
    which may be less than SIZE if end of file is reached.
-   Advances FILE's position by the number of bytes read. */
+   Advances FILE's position by the number of bytes read.
+
+   A read that starts where the previous one ended doubles the
+   number of sectors past it to read ahead, up to
+   cache_readahead_max; any other read stops readahead. */
 off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
-  off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  off_t bytes_read;
+
+  if (file->pos == file->ra_next && cache_readahead_max > 0)
+    {
+      file->ra_window = file->ra_window == 0 ? 4 : file->ra_window * 2;
+      if (file->ra_window > (off_t) cache_readahead_max)
+        file->ra_window = cache_readahead_max;
+    }
+  else
+    {
+      file->ra_window = 0;
+      file->ra_end = 0;
+    }
+
+  bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
   file->pos += bytes_read;
+  file->ra_next = file->pos;
+
+  if (file->ra_window > 0)
+    {
+      off_t end = file->pos + file->ra_window * BLOCK_SECTOR_SIZE;
+      off_t start = file->ra_end > file->pos ? file->ra_end : file->pos;
+      if (end > start)
+        {
+          inode_readahead (file->inode, start, end - start);
+          file->ra_end = end;
+        }
+    }
   return bytes_read;
 }
 
@@ -79,10 +114,9 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
-   Advances FILE's position by the number of bytes read. */
+   which may be less than SIZE if the disk is full.
+   A write past end of file grows the file.
+   Advances FILE's position by the number of bytes written. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
 {
@@ -94,9 +128,8 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
+   A write past end of file grows the file.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
@@ -11,6 +11,11 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+
+    /* Sequential readahead, see file_read(). */
+    off_t ra_next;              /* Offset a sequential read starts at. */
+    off_t ra_end;               /* End of what was read ahead. */
+    off_t ra_window;            /* Sectors to keep read ahead. */
   };
 
 /* Opening and closing files. */
@@ -2,10 +2,13 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dentry.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "threads/malloc.h"
 #include "threads/thread.h"
 #include "lib/stdio.h"
 #include "lib/kernel/stdio.h"
@@ -15,36 +18,40 @@
 /* Partition that contains the file system. */
 struct block *fs_device;
 
-/* Global lock for file system */
-static struct lock filesys_lock;
-
-/* Acquire the lock for file system */
-static void acquire_filesys_lock() {
-  lock_acquire(&filesys_lock);
-}
-
-/* Release the lock for file system */
-static void release_filesys_lock() {
-  lock_release(&filesys_lock);
-}
+/* There is no global file system lock.  The open inode table,
+   each inode, each directory, the free map and the buffer cache
+   have locks of their own, so the calls below need none.  A
+   file's position belongs to the one process that has it open. */
 
 static void do_format (void);
+static struct dir *resolve (const char *path, char name[NAME_MAX + 1]);
+static void discard_inode (block_sector_t);
 
 /* Initializes the file system module.
    If FORMAT is true, reformats the file system. */
 void
 filesys_init (bool format) 
 {
-  lock_init (&filesys_lock);
   fs_device = block_get_role (BLOCK_FILESYS);
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
   inode_init ();
+  dentry_init ();
   free_map_init ();
 
   if (format) 
     do_format ();
+  else
+    {
+      /* New files take the format the file system was made in. */
+      struct inode *root = inode_open (ROOT_DIR_SECTOR);
+      if (root == NULL)
+        PANIC ("can't open root directory");
+      inode_format = inode_get_format (root);
+      inode_close (root);
+    }
 
   free_map_open ();
 }
@@ -55,29 +62,66 @@ void
 filesys_done (void) 
 {
   free_map_close ();
+  cache_shutdown ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
+   NAME is a path, relative to the current directory unless it
+   starts with "/".
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
    or if internal memory allocation fails. */
 bool
 filesys_create (const char *name, off_t initial_size) 
 {
+  char base[NAME_MAX + 1];
   block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
+  struct dir *dir = resolve (name, base);
   bool success = (dir != NULL
                   && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
-  if (!success && inode_sector != 0) 
+                  && inode_create (inode_sector, initial_size, 0));
+  if (success && !dir_add (dir, base, inode_sector))
+    {
+      discard_inode (inode_sector);
+      success = false;
+    }
+  else if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
   dir_close (dir);
 
   return success;
 }
 
-/* Opens the file with the given NAME.
+/* Creates a directory named NAME, a path like that passed to
+   filesys_create().
+   Returns true if successful, false otherwise.
+   Fails if a file named NAME already exists, if the directory
+   that would contain it does not, or if internal memory
+   allocation fails. */
+bool
+filesys_mkdir (const char *name) 
+{
+  char base[NAME_MAX + 1];
+  block_sector_t inode_sector = 0;
+  struct dir *dir = resolve (name, base);
+  bool success = (dir != NULL
+                  && free_map_allocate (1, &inode_sector)
+                  && dir_create (inode_sector, 0,
+                                 inode_get_inumber (dir_get_inode (dir))));
+  if (success && !dir_add (dir, base, inode_sector))
+    {
+      discard_inode (inode_sector);
+      success = false;
+    }
+  else if (!success && inode_sector != 0) 
+    free_map_release (inode_sector, 1);
+  dir_close (dir);
+
+  return success;
+}
+
+/* Opens the file with the given NAME, a path like that passed to
+   filesys_create(), which may also name a directory.
    Returns the new file if successful or a null pointer
    otherwise.
    Fails if no file named NAME exists,
@@ -85,37 +129,132 @@ filesys_create (const char *name, off_t initial_size)
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
+  char base[NAME_MAX + 1];
+  struct dir *dir = resolve (name, base);
   struct inode *inode = NULL;
 
   if (dir != NULL)
-    dir_lookup (dir, name, &inode);
+    dir_lookup (dir, base, &inode);
   dir_close (dir);
 
   return file_open (inode);
 }
 
-/* Deletes the file named NAME.
+/* Deletes the file named NAME, a path like that passed to
+   filesys_create().  A directory may be deleted only if it is
+   empty.
    Returns true if successful, false on failure.
    Fails if no file named NAME exists,
    or if an internal memory allocation fails. */
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  char base[NAME_MAX + 1];
+  struct dir *dir = resolve (name, base);
+  bool success = dir != NULL && dir_remove (dir, base);
   dir_close (dir); 
 
   return success;
 }
-
+
+/* Changes the current directory of the running thread to NAME, a
+   path like that passed to filesys_create().
+   Returns true if successful, false if NAME does not name a
+   directory. */
+bool
+filesys_chdir (const char *name) 
+{
+  char base[NAME_MAX + 1];
+  struct dir *dir = resolve (name, base);
+  struct inode *inode = NULL;
+  struct thread *t = thread_current ();
+
+  if (dir != NULL)
+    dir_lookup (dir, base, &inode);
+  dir_close (dir);
+
+  dir = dir_open (inode);
+  if (dir == NULL)
+    return false;
+  dir_close (t->cwd);
+  t->cwd = dir;
+  return true;
+}
+
+/* Follows PATH up to its last component, which it copies into
+   NAME, and returns the directory that should contain it.  If
+   PATH ends in "/", NAME is ".".  The caller must close the
+   directory.  Returns a null pointer if PATH is empty, if a
+   component is longer than NAME_MAX, or if a component before
+   the last is not a directory. */
+static struct dir *
+resolve (const char *path, char name[NAME_MAX + 1]) 
+{
+  struct dir *cwd = thread_current ()->cwd;
+  struct dir *dir;
+  const char *part, *end;
+
+  if (*path == '\0')
+    return NULL;
+  dir = *path == '/' || cwd == NULL ? dir_open_root () : dir_reopen (cwd);
+
+  strlcpy (name, ".", NAME_MAX + 1);
+  for (part = path; dir != NULL; part = end)
+    {
+      struct inode *inode;
+
+      /* Find the next component, from PART up to END. */
+      while (*part == '/')
+        part++;
+      if (*part == '\0')
+        break;
+      end = strchr (part, '/');
+      if (end == NULL)
+        end = part + strlen (part);
+      if (end - part > NAME_MAX)
+        {
+          dir_close (dir);
+          return NULL;
+        }
+      memcpy (name, part, end - part);
+      name[end - part] = '\0';
+
+      /* The last component is left for the caller. */
+      if (*end == '\0')
+        break;
+
+      /* Walk through any other. */
+      dir_lookup (dir, name, &inode);
+      dir_close (dir);
+      dir = dir_open (inode);
+      strlcpy (name, ".", NAME_MAX + 1);
+    }
+  return dir;
+}
+
+/* Frees a new inode in SECTOR, with any data it has, that could
+   not be added to a directory. */
+static void
+discard_inode (block_sector_t sector) 
+{
+  struct inode *inode = inode_open (sector);
+  if (inode != NULL)
+    {
+      inode_remove (inode);
+      inode_close (inode);
+    }
+  else
+    free_map_release (sector, 1);
+}
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
-  printf ("Formatting file system...");
+  printf ("Formatting file system%s...",
+          inode_format == INODE_EXTENTS ? " with extents" : "");
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, 16, ROOT_DIR_SECTOR))
     PANIC ("root directory creation failed");
   free_map_close ();
   printf ("done.\n");
@@ -144,27 +283,35 @@ get_file(int fd) {
 /* To create file from process */
 bool
 create_file(const char *name, off_t initial_size) {
-  acquire_filesys_lock();
   int success = filesys_create(name, initial_size);
-  release_filesys_lock();
   return success;
 }
 
 /* To remove file from process */
 bool
 remove_file(const char *name) {
-  acquire_filesys_lock();
   int success = filesys_remove(name);
-  release_filesys_lock();
+  return success;
+}
+
+/* To create a directory from process */
+bool
+make_dir(const char *name) {
+  bool success = filesys_mkdir(name);
+  return success;
+}
+
+/* To change the current directory of the process */
+bool
+change_dir(const char *name) {
+  bool success = filesys_chdir(name);
   return success;
 }
 
 /* To open file from process */
 int
 open_file(const char *name, bool executable) {
-  acquire_filesys_lock();
   struct file *f = filesys_open(name);
-  release_filesys_lock();
 
   if(f == NULL) {
     return -1;
@@ -187,11 +334,9 @@ open_file(const char *name, bool executable) {
   // printf("fd should be %d\n", -1);
 
   // /* Not able to find available file descriptor */
-  // acquire_filesys_lock();
   // printf("Finish closing1\n");
   // file_close(name);
   // printf("Finish closing2\n");
-  // release_filesys_lock();
   // printf("Finish closing3\n");
   return -1;
 }
@@ -206,9 +351,7 @@ get_file_size(int fd) {
   }
   
   off_t size = 0;
-  acquire_filesys_lock();
   size = file_length(f);
-  release_filesys_lock();
 
   return size;
 }
@@ -236,9 +379,12 @@ read_file(int fd, void *buffer_, off_t size) {
     return 0;
   }
 
-  acquire_filesys_lock();
+  /* Directories are read with read_dir() */
+  if(inode_is_dir(file_get_inode(f))) {
+    return -1;
+  }
+
   bytes_read = file_read(f, buffer, size);
-  release_filesys_lock();
 
   return bytes_read;
 }
@@ -257,9 +403,12 @@ write_to_file(int fd, const void *buffer, off_t size) {
     return 0;
   }
 
-  acquire_filesys_lock();
+  /* Directories change only through the calls that name files */
+  if(inode_is_dir(file_get_inode(f))) {
+    return -1;
+  }
+
   off_t byte_written = file_write(f, buffer, size);
-  release_filesys_lock();
 
   return byte_written;
 }
@@ -271,9 +420,7 @@ seek_file(int fd, off_t new_pos) {
   if(f == NULL) {
     return;
   }
-  acquire_filesys_lock();
   file_seek(f, new_pos);
-  release_filesys_lock();
 }
 
 /* Get the current position in the file */
@@ -283,12 +430,83 @@ cur_pos_file(int fd) {
   if(f == NULL) {
     return 0;
   }
-  acquire_filesys_lock();
   off_t cur_pos = file_tell(f);
-  release_filesys_lock();
   return cur_pos;
 }
 
+/* Read the next entry of directory FD into NAME, which has room
+   for NAME_MAX + 1 bytes.  The file position of FD keeps track of
+   the entries already read. */
+bool
+read_dir(int fd, char *name) {
+  struct file *f = get_file(fd);
+  if(f == NULL || !inode_is_dir(file_get_inode(f))) {
+    return false;
+  }
+
+  struct dir *dir = dir_open(inode_reopen(file_get_inode(f)));
+  if(dir == NULL) {
+    return false;
+  }
+
+  dir_seek(dir, file_tell(f));
+  bool success = dir_readdir(dir, name);
+  file_seek(f, dir_tell(dir));
+  dir_close(dir);
+  return success;
+}
+
+/* Whether FD is an open directory */
+bool
+is_dir_file(int fd) {
+  struct file *f = get_file(fd);
+  if(f == NULL) {
+    return false;
+  }
+  return inode_is_dir(file_get_inode(f));
+}
+
+/* Get the inode number of the file, or -1 if FD is not open */
+int
+get_file_inumber(int fd) {
+  struct file *f = get_file(fd);
+  if(f == NULL) {
+    return -1;
+  }
+  return inode_get_inumber(file_get_inode(f));
+}
+
+/* Reopen the file of FD for the kernel's own use, outside the
+   file descriptor table, so that it stays open whatever the
+   process does with FD.  Returns NULL if FD is not open or memory
+   runs out. */
+struct file*
+reopen_file(int fd, bool executable) {
+  struct file *f = get_file(fd);
+  if(f == NULL) {
+    return NULL;
+  }
+
+  struct file *copy = file_reopen(f);
+  if(copy != NULL && executable) {
+    file_deny_write(copy);
+  }
+  return copy;
+}
+
+/* Read SIZE bytes at offset OFS of a file from reopen_file() */
+off_t
+read_file_at(struct file *f, void *buffer, off_t size, off_t ofs) {
+  off_t bytes_read = file_read_at(f, buffer, size, ofs);
+  return bytes_read;
+}
+
+/* Close a file from reopen_file() */
+void
+close_reopened_file(struct file *f) {
+  file_close(f);
+}
+
 /* Close the file from process */
 void
 close_file(int fd) {
@@ -299,8 +517,6 @@ close_file(int fd) {
     return;
   }
 
-  acquire_filesys_lock();
   file_close(f);
-  release_filesys_lock();
   cur_thread->fdt[fd] = NULL;
 }
\ No newline at end of file
@@ -18,18 +18,28 @@ void filesys_done (void);
 bool filesys_create (const char *name, off_t initial_size);
 struct file *filesys_open (const char *name);
 bool filesys_remove (const char *name);
+bool filesys_mkdir (const char *name);
+bool filesys_chdir (const char *name);
 
 void close_all_files();
 
 struct file *get_file(int);
 bool create_file(const char*, off_t);
 bool remove_file(const char*);
+bool make_dir(const char*);
+bool change_dir(const char*);
 int open_file(const char*, bool);
 off_t get_file_size(int );
 off_t read_file(int, void*, off_t);
 off_t write_to_file(int, const void*, off_t);
 void seek_file(int, off_t);
 off_t cur_pos_file(int);
+bool read_dir(int, char*);
+bool is_dir_file(int);
+int get_file_inumber(int);
 void close_file(int);
+struct file *reopen_file(int, bool);
+off_t read_file_at(struct file*, void*, off_t, off_t);
+void close_reopened_file(struct file*);
 
 #endif /* filesys/filesys.h */
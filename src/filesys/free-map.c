@@ -1,22 +1,67 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include <stdio.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* The free map is summarized in memory, in groups of as many
+   sectors as one sector of the free map file describes: each
+   group's count of free sectors, and a bitmap of the groups that
+   have any.  Allocation skips full groups using the summary and
+   searches onward from where the last allocation ended, so that
+   on a mostly full disk it need not walk the map from sector 0.
+   Only the free map itself is kept on disk.
+
+   Each group is also the unit of writing: an allocation or
+   release marks the groups it touches dirty, and only their
+   sectors of the free map file are written back. */
+
+/* Sectors per group. */
+#define GROUP_SECTORS (BLOCK_SECTOR_SIZE * 8)
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct bitmap *free_groups;   /* Groups with free sectors. */
+static size_t *group_free_cnt;       /* Free sectors in each group. */
+static size_t next_sector;           /* Where to start searching. */
+static struct bitmap *dirty_groups;  /* Groups not yet written. */
+static struct lock free_map_lock;    /* Protects all of the above. */
+
+/* Statistics. */
+static long long op_cnt;             /* # of allocations and releases. */
+static long long write_cnt;          /* # of free map sectors written. */
+
+static void summarize (void);
+static void account (block_sector_t, size_t cnt, bool used);
+static block_sector_t find_free (size_t start, size_t cnt);
+static bool allocate (size_t cnt, block_sector_t *);
+static bool mark_used (block_sector_t, size_t cnt);
+static bool flush (void);
 
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
+  size_t group_cnt;
+
+  lock_init (&free_map_lock);
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  free_groups = bitmap_create (group_cnt);
+  dirty_groups = bitmap_create (group_cnt);
+  group_free_cnt = malloc (group_cnt * sizeof *group_free_cnt);
+  if (free_groups == NULL || dirty_groups == NULL || group_free_cnt == NULL)
+    PANIC ("can't allocate free map summary");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  summarize ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -27,26 +72,263 @@ free_map_init (void)
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = allocate (cnt, sectorp);
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Allocates the largest run of free sectors available, up to
+   MAX_CNT of them, preferring the first run of MAX_CNT after the
+   last allocation.  Stores its first sector into *SECTORP and its
+   length into *CNTP.
+   Returns true if successful, false if the disk is full or the
+   free map file could not be written. */
+bool
+free_map_allocate_run (size_t max_cnt, block_sector_t *sectorp,
+                       size_t *cntp)
+{
+  size_t best_start = 0, best_cnt = 0;
+  size_t start;
+
+  ASSERT (max_cnt > 0);
+
+  lock_acquire (&free_map_lock);
+  if (allocate (max_cnt, sectorp))
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      lock_release (&free_map_lock);
+      *cntp = max_cnt;
+      return true;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+
+  /* No run is long enough: take the longest there is, walking
+     the runs from free sector to used sector. */
+  for (start = find_free (0, 1); start != BITMAP_ERROR;
+       start = find_free (start, 1))
+    {
+      size_t end = bitmap_scan (free_map, start, 1, true);
+      if (end == BITMAP_ERROR)
+        end = bitmap_size (free_map);
+      if (end - start > best_cnt)
+        {
+          best_start = start;
+          best_cnt = end - start;
+        }
+      start = end;
+    }
+
+  if (best_cnt == 0 || !mark_used (best_start, best_cnt))
+    {
+      lock_release (&free_map_lock);
+      return false;
+    }
+  lock_release (&free_map_lock);
+  *sectorp = best_start;
+  *cntp = best_cnt;
+  return true;
+}
+
+/* Allocates as many as MAX_CNT free sectors starting exactly at
+   SECTOR, to extend a run of sectors that ends there.
+   Returns the number allocated, which is 0 if SECTOR is in use
+   or past the end of the disk. */
+size_t
+free_map_allocate_at (block_sector_t sector, size_t max_cnt)
+{
+  size_t end;
+
+  if (sector >= bitmap_size (free_map))
+    return 0;
+  if (max_cnt > bitmap_size (free_map) - sector)
+    max_cnt = bitmap_size (free_map) - sector;
+
+  lock_acquire (&free_map_lock);
+  end = bitmap_scan (free_map, sector, 1, true);
+  if (end == BITMAP_ERROR || end > sector + max_cnt)
+    end = sector + max_cnt;
+  if (end == sector || !mark_used (sector, end - sector))
+    end = sector;
+  lock_release (&free_map_lock);
+  return end - sector;
 }
 
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  account (sector, cnt, false);
+  op_cnt++;
+  flush ();
+  lock_release (&free_map_lock);
+}
+
+/* Prints free map statistics. */
+void
+free_map_print_stats (void) 
+{
+  if (free_map == NULL)
+    return;
+  printf ("Free map: %lld allocations and releases, "
+          "%lld sectors written", op_cnt, write_cnt);
+  if (op_cnt > 0)
+    printf (" (%lld.%02lld per operation)",
+            write_cnt / op_cnt, write_cnt * 100 / op_cnt % 100);
+  printf ("\n");
+}
+
+/* Allocates CNT consecutive sectors, next-fit, and stores the
+   first into *SECTORP.  The caller must hold free_map_lock. */
+static bool
+allocate (size_t cnt, block_sector_t *sectorp)
+{
+  block_sector_t sector = find_free (next_sector, cnt);
+  if (sector == BITMAP_ERROR && next_sector > 0)
+    sector = find_free (0, cnt);
+  if (sector == BITMAP_ERROR || !mark_used (sector, cnt))
+    return false;
+  *sectorp = sector;
+  return true;
+}
+
+/* Marks the CNT sectors starting at SECTOR used and writes the
+   change to disk.  Returns true if successful, false if the free
+   map file could not be written, in which case the sectors stay
+   free. */
+static bool
+mark_used (block_sector_t sector, size_t cnt)
+{
+  bitmap_set_multiple (free_map, sector, cnt, true);
+  account (sector, cnt, true);
+  op_cnt++;
+  if (free_map_file != NULL && !flush ())
+    {
+      bitmap_set_multiple (free_map, sector, cnt, false); 
+      account (sector, cnt, false);
+      return false;
+    }
+  next_sector = sector + cnt < bitmap_size (free_map) ? sector + cnt : 0;
+  return true;
+}
+
+/* Returns the first sector at or after START that begins CNT
+   free sectors, or BITMAP_ERROR if there is none.
+
+   Only groups with a free sector are searched, each for runs
+   that start in it.  A run cannot pass through a full group, so
+   a search that runs past the end of its group does so by less
+   than CNT sectors. */
+static block_sector_t
+find_free (size_t start, size_t cnt)
+{
+  size_t sector_cnt = bitmap_size (free_map);
+  size_t group;
+
+  if (cnt == 0 || start >= sector_cnt)
+    return bitmap_scan (free_map, start, cnt, false);
+
+  for (group = bitmap_scan (free_groups, start / GROUP_SECTORS, 1, true);
+       group != BITMAP_ERROR;
+       group = bitmap_scan (free_groups, group + 1, 1, true))
+    {
+      size_t i = group * GROUP_SECTORS;
+      size_t end = i + GROUP_SECTORS;
+      if (i < start)
+        i = start;
+      if (end > sector_cnt)
+        end = sector_cnt;
+
+      while (i < end && bitmap_contains (free_map, i, end - i, false))
+        {
+          /* Skip to the next free sector, which is in this group,
+             then check the CNT sectors that start there. */
+          i = bitmap_scan (free_map, i, 1, false);
+          if (sector_cnt - i < cnt)
+            return BITMAP_ERROR;
+          if (!bitmap_contains (free_map, i, cnt, true))
+            return i;
+          i = bitmap_scan (free_map, i, 1, true);
+        }
+    }
+  return BITMAP_ERROR;
+}
+
+/* Writes the sectors of the free map file that hold dirty
+   groups.  Returns true if successful, false if any could not be
+   written, which stay dirty. */
+static bool
+flush (void) 
+{
+  bool success = true;
+  size_t group = 0;
+
+  while ((group = bitmap_scan (dirty_groups, group, 1, true)) != BITMAP_ERROR)
+    {
+      size_t start = group * GROUP_SECTORS;
+      size_t cnt = bitmap_size (free_map) - start;
+      if (cnt > GROUP_SECTORS)
+        cnt = GROUP_SECTORS;
+
+      if (bitmap_write_range (free_map, free_map_file, start, cnt))
+        {
+          bitmap_reset (dirty_groups, group);
+          write_cnt++;
+        }
+      else
+        success = false;
+      group++;
+    }
+  return success;
+}
+
+/* Recomputes the summary from the free map. */
+static void
+summarize (void) 
+{
+  size_t group;
+
+  for (group = 0; group < bitmap_size (free_groups); group++)
+    {
+      size_t start = group * GROUP_SECTORS;
+      size_t cnt = bitmap_size (free_map) - start;
+      if (cnt > GROUP_SECTORS)
+        cnt = GROUP_SECTORS;
+      group_free_cnt[group] = bitmap_count (free_map, start, cnt, false);
+      bitmap_set (free_groups, group, group_free_cnt[group] > 0);
+    }
+  bitmap_set_all (dirty_groups, false);
+  next_sector = 0;
+}
+
+/* Updates the summary for CNT sectors starting at SECTOR, which
+   have just been marked USED or free. */
+static void
+account (block_sector_t sector, size_t cnt, bool used) 
+{
+  while (cnt > 0)
+    {
+      size_t group = sector / GROUP_SECTORS;
+      size_t n = (group + 1) * GROUP_SECTORS - sector;
+      if (n > cnt)
+        n = cnt;
+
+      if (used)
+        {
+          ASSERT (group_free_cnt[group] >= n);
+          group_free_cnt[group] -= n;
+        }
+      else
+        group_free_cnt[group] += n;
+      bitmap_set (free_groups, group, group_free_cnt[group] > 0);
+      bitmap_mark (dirty_groups, group);
+
+      sector += n;
+      cnt -= n;
+    }
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,6 +340,7 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  summarize ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
@@ -72,14 +355,23 @@ free_map_close (void)
 void
 free_map_create (void) 
 {
+  struct file *file;
+
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), 0))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  /* Write bitmap to file.  Until that is done, allocating the
+     file's sectors must not try to write them. */
+  file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_write (free_map, free_map_file))
+  if (!bitmap_write (free_map, file))
+    PANIC ("can't write free map");
+  free_map_file = file;
+
+  /* Writing the file allocated its sectors, changing parts of the
+     map that may already have been written. */
+  if (!flush ())
     PANIC ("can't write free map");
 }
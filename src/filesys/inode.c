@@ -1,25 +1,123 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
-/* Identifies an inode. */
+/* Identify an inode and the format of its data: INODE_MAGIC for
+   index blocks, EXTENT_MAGIC for extents, INLINE_MAGIC for data
+   held in the inode itself. */
 #define INODE_MAGIC 0x494e4f44
+#define EXTENT_MAGIC 0x494e4f45
+#define INLINE_MAGIC 0x494e4f49
+
+/* Most bytes of data held in an inode itself. */
+#define INLINE_MAX 500
+
+/* Number of data sectors named directly by an inode. */
+#define DIRECT_CNT 123
+
+/* Number of sector numbers in an index block. */
+#define PTRS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Largest number of data sectors in a file. */
+#define MAX_SECTORS (DIRECT_CNT + PTRS_PER_SECTOR \
+                     + PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+
+/* A run of consecutive sectors. */
+struct extent
+  {
+    block_sector_t start;               /* First sector. */
+    uint32_t length;                    /* Number of sectors. */
+  };
+
+/* Number of extents held in an inode. */
+#define EXTENT_CNT 61
+
+/* Overflow block of extents, for those past the first
+   EXTENT_CNT.  Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+#define EXTENTS_PER_BLOCK 63
+struct extent_block
+  {
+    struct extent extents[EXTENTS_PER_BLOCK];
+    block_sector_t next;                /* Next overflow block, or 0. */
+    uint32_t unused;                    /* Not used. */
+  };
+
+/* Offset of the next field in an overflow block. */
+#define NEXT_OFS offsetof (struct extent_block, next)
+
+/* Most sectors to preallocate past the end of a growing file
+   with extents, so that it grows in long runs. */
+#define EXTENT_PREALLOC 64
 
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   With index blocks, data sector I of a file is direct[I] for
+   the first DIRECT_CNT sectors.  The next PTRS_PER_SECTOR are
+   named by the index block INDIRECT, and the rest by the index
+   blocks named in turn by the index block DOUBLY_INDIRECT.
+   Sector 0, which holds the free map inode, stands for a sector
+   not allocated.
+
+   With extents, the file's sectors are the runs EXTENTS[0],
+   EXTENTS[1], and so on, followed by those in the chain of
+   overflow blocks starting at OVERFLOW.  They may run past the
+   end of the file, which grows into them.  A run that starts at
+   sector 0 is a hole of that many sectors not allocated, as are
+   any sectors past the last run.
+
+   Sectors not allocated read as zeros and are allocated when
+   first written, so that creating a file allocates nothing.
+
+   A file of at most INLINE_MAX bytes starts out with its data in
+   INLINE_DATA, so that it needs no data sectors and is read along
+   with its inode.  The bytes past its length are zeros.  Once it
+   is written past INLINE_MAX, the data moves to a sector of its
+   own and the inode takes on the format of new inodes.
+
+   A directory's PARENT is the sector of its parent directory's
+   inode, which for the root directory is its own.  Other inodes
+   have 0 there, which is the free map inode's sector and so
+   never a directory. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    block_sector_t parent;              /* Parent if a directory, else 0. */
+    union
+      {
+        struct                          /* INODE_MAGIC. */
+          {
+            block_sector_t direct[DIRECT_CNT]; /* Direct data sectors. */
+            block_sector_t indirect;    /* Indirect index block. */
+            block_sector_t doubly_indirect; /* Doubly indirect block. */
+          };
+        struct                          /* EXTENT_MAGIC. */
+          {
+            uint32_t extent_cnt;        /* Number of extents. */
+            uint32_t sector_cnt;        /* Sectors in all extents. */
+            block_sector_t overflow;    /* First overflow block, or 0. */
+            struct extent extents[EXTENT_CNT]; /* First extents. */
+          };
+        uint8_t inline_data[INLINE_MAX]; /* INLINE_MAGIC. */
+      };
   };
 
+/* Format of new inodes. */
+enum inode_format inode_format = INODE_INDEXED;
+
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
 static inline size_t
@@ -28,49 +126,605 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* In-memory inode.
+
+   open_inodes_lock protects ELEM, CLOSED_ELEM, CLOSED_TICKS,
+   OPEN_CNT and LOADING.  LOCK serializes writes that grow the
+   file, which change DATA, and changes to DENY_WRITE_CNT.  Reads
+   take no lock: a file's length grows only after the sectors and
+   index entries it covers are in place, so a reader that sees the
+   new length also finds its data.  Data held inline is the
+   exception, read and written with LOCK held, since moving it out
+   reuses the same bytes. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
+    struct list_elem closed_elem;       /* Element in closed_inodes. */
+    int64_t closed_ticks;               /* When last closed. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
+    bool loading;                       /* DATA not read in yet? */
+    struct condition loaded;            /* Signaled when DATA is read. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct lock lock;                   /* See above. */
+    struct lock dir_lock;               /* Held to update a directory. */
+    void *dir_cache;                    /* Directory state, or null. */
+    void (*free_dir_cache) (void *);    /* Frees DIR_CACHE. */
     struct inode_disk data;             /* Inode content. */
   };
 
+/* Allocates a sector, fills it with zeros, and returns it, or 0
+   if the disk is full. */
+static block_sector_t
+alloc_zeroed (void)
+{
+  block_sector_t sector;
+
+  if (!free_map_allocate (1, &sector))
+    return 0;
+  cache_zero (sector);
+  return sector;
+}
+
+/* Returns the sector named by *SLOTP, a sector number held in an
+   inode, first allocating a zeroed sector for it if it is 0 and
+   CREATE is true.  Returns 0 if there is none. */
+static block_sector_t
+follow (block_sector_t *slotp, bool create)
+{
+  if (*slotp == 0 && create)
+    *slotp = alloc_zeroed ();
+  return *slotp;
+}
+
+/* Like follow(), for entry IDX of index block BLOCK. */
+static block_sector_t
+follow_index (block_sector_t block, size_t idx, bool create)
+{
+  block_sector_t sector;
+
+  cache_read_at (block, &sector, idx * sizeof sector, sizeof sector);
+  if (sector == 0 && create)
+    {
+      sector = alloc_zeroed ();
+      if (sector != 0)
+        cache_write_at (block, &sector, idx * sizeof sector, sizeof sector);
+    }
+  return sector;
+}
+
+/* Returns data sector IDX of the file whose inode is DISK, which
+   uses index blocks, or 0 if it is not allocated.  If CREATE is
+   true, allocates it and any index blocks on the way to it
+   first, all zeroed, in which case 0 means the disk is full.
+   The caller must write DISK back if it changes. */
+static block_sector_t
+index_sector (struct inode_disk *disk, size_t idx, bool create)
+{
+  block_sector_t block;
+
+  if (idx < DIRECT_CNT)
+    return follow (&disk->direct[idx], create);
+  idx -= DIRECT_CNT;
+
+  if (idx < PTRS_PER_SECTOR)
+    {
+      block = follow (&disk->indirect, create);
+      return block != 0 ? follow_index (block, idx, create) : 0;
+    }
+  idx -= PTRS_PER_SECTOR;
+
+  if (idx < PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+    {
+      block = follow (&disk->doubly_indirect, create);
+      if (block != 0)
+        block = follow_index (block, idx / PTRS_PER_SECTOR, create);
+      return block != 0 ? follow_index (block, idx % PTRS_PER_SECTOR,
+                                        create) : 0;
+    }
+  return 0;
+}
+
+/* Reads extent I of DISK into *E. */
+static void
+get_extent (const struct inode_disk *disk, size_t i, struct extent *e)
+{
+  block_sector_t block = disk->overflow;
+
+  if (i < EXTENT_CNT)
+    {
+      *e = disk->extents[i];
+      return;
+    }
+  for (i -= EXTENT_CNT; i >= EXTENTS_PER_BLOCK; i -= EXTENTS_PER_BLOCK)
+    cache_read_at (block, &block, NEXT_OFS,
+                   sizeof block);
+  cache_read_at (block, e, i * sizeof *e, sizeof *e);
+}
+
+/* Stores *E as extent I of DISK, allocating overflow blocks as
+   needed.  Returns false if the disk is full.  The caller must
+   write DISK back. */
+static bool
+put_extent (struct inode_disk *disk, size_t i, const struct extent *e)
+{
+  block_sector_t block;
+
+  if (i < EXTENT_CNT)
+    {
+      disk->extents[i] = *e;
+      return true;
+    }
+  i -= EXTENT_CNT;
+  if (disk->overflow == 0 && (disk->overflow = alloc_zeroed ()) == 0)
+    return false;
+  for (block = disk->overflow; i >= EXTENTS_PER_BLOCK;
+       i -= EXTENTS_PER_BLOCK)
+    {
+      block_sector_t next;
+
+      cache_read_at (block, &next, NEXT_OFS, sizeof next);
+      if (next == 0)
+        {
+          next = alloc_zeroed ();
+          if (next == 0)
+            return false;
+          cache_write_at (block, &next, NEXT_OFS, sizeof next);
+        }
+      block = next;
+    }
+  cache_write_at (block, e, i * sizeof *e, sizeof *e);
+  return true;
+}
+
+/* Returns data sector IDX of the file whose inode is DISK, which
+   uses extents, or 0 if it is not allocated. */
+static block_sector_t
+extent_sector (const struct inode_disk *disk, size_t idx)
+{
+  size_t i;
+
+  for (i = 0; i < disk->extent_cnt; i++)
+    {
+      struct extent e;
+
+      get_extent (disk, i, &e);
+      if (idx < e.length)
+        return e.start != 0 ? e.start + idx : 0;
+      idx -= e.length;
+    }
+  return 0;
+}
+
+/* Moves extents I and after of DISK up by CNT places, leaving
+   room for CNT more at I.  Returns false if the disk is full, in
+   which case nothing moves.  The caller must write DISK back. */
+static bool
+make_room (struct inode_disk *disk, size_t i, size_t cnt)
+{
+  struct extent e = { 0, 0 };
+  size_t j;
+
+  if (cnt == 0)
+    return true;
+
+  /* Moving the last one first allocates any overflow blocks. */
+  if (disk->extent_cnt > i)
+    get_extent (disk, disk->extent_cnt - 1, &e);
+  if (!put_extent (disk, disk->extent_cnt - 1 + cnt, &e))
+    return false;
+  for (j = disk->extent_cnt - 1; j-- > i; )
+    {
+      get_extent (disk, j, &e);
+      put_extent (disk, j + cnt, &e);
+    }
+  disk->extent_cnt += cnt;
+  return true;
+}
+
+/* Removes extent I of DISK, moving those after it down. */
+static void
+remove_extent (struct inode_disk *disk, size_t i)
+{
+  for (; i + 1 < disk->extent_cnt; i++)
+    {
+      struct extent e;
+      get_extent (disk, i + 1, &e);
+      put_extent (disk, i, &e);
+    }
+  disk->extent_cnt--;
+}
+
+/* Adds a hole of CNT sectors after the last extent of DISK.
+   Returns false if the disk is full. */
+static bool
+add_hole (struct inode_disk *disk, size_t cnt)
+{
+  struct extent e;
+
+  if (disk->extent_cnt > 0)
+    {
+      get_extent (disk, disk->extent_cnt - 1, &e);
+      if (e.start == 0)
+        {
+          e.length += cnt;
+          put_extent (disk, disk->extent_cnt - 1, &e);
+          disk->sector_cnt += cnt;
+          return true;
+        }
+    }
+
+  e.start = 0;
+  e.length = cnt;
+  if (!put_extent (disk, disk->extent_cnt, &e))
+    return false;
+  disk->extent_cnt++;
+  disk->sector_cnt += cnt;
+  return true;
+}
+
+/* Allocates data sector IDX of DISK, which uses extents and has
+   sector IDX in hole I at offset OFS within it, and returns it,
+   or 0 if the disk is full.  The sector extends the run before
+   the hole if it is at the start of the hole and the sector
+   after that run is free.  Otherwise, the hole is split around a
+   sector allocated elsewhere. */
+static block_sector_t
+fill_hole (struct inode_disk *disk, size_t i, size_t ofs)
+{
+  struct extent hole, parts[3];
+  block_sector_t sector;
+  size_t part_cnt = 0, j;
+
+  get_extent (disk, i, &hole);
+  ASSERT (hole.start == 0 && ofs < hole.length);
+
+  if (ofs == 0 && i > 0)
+    {
+      struct extent prev;
+
+      get_extent (disk, i - 1, &prev);
+      if (prev.start != 0
+          && free_map_allocate_at (prev.start + prev.length, 1) == 1)
+        {
+          sector = prev.start + prev.length;
+          prev.length++;
+          put_extent (disk, i - 1, &prev);
+          if (--hole.length > 0)
+            put_extent (disk, i, &hole);
+          else
+            remove_extent (disk, i);
+          return sector;
+        }
+    }
+
+  if (!free_map_allocate (1, &sector))
+    return 0;
+  if (ofs > 0)
+    parts[part_cnt++] = (struct extent) { 0, ofs };
+  parts[part_cnt++] = (struct extent) { sector, 1 };
+  if (ofs + 1 < hole.length)
+    parts[part_cnt++] = (struct extent) { 0, hole.length - ofs - 1 };
+  if (!make_room (disk, i + 1, part_cnt - 1))
+    {
+      free_map_release (sector, 1);
+      return 0;
+    }
+  for (j = 0; j < part_cnt; j++)
+    put_extent (disk, i + j, &parts[j]);
+  return sector;
+}
+
+static bool extend_extents (struct inode_disk *, size_t sector_cnt);
+
+/* Returns data sector IDX of the file whose inode is DISK, which
+   uses extents, first allocating it if it is not allocated.  A
+   new sector is not zeroed; see inode_write_at().  Returns 0 if
+   the disk is full.  The caller must write DISK back. */
+static block_sector_t
+extent_alloc (struct inode_disk *disk, size_t idx)
+{
+  size_t i, ofs = idx;
+
+  /* Past the extents: cover any gap with a hole, then grow.
+     Sectors preallocated inside the file must read as zeros. */
+  if (idx >= disk->sector_cnt)
+    {
+      size_t end = bytes_to_sectors (disk->length);
+
+      if (idx > disk->sector_cnt && !add_hole (disk, idx - disk->sector_cnt))
+        return 0;
+      if (!extend_extents (disk, idx + 1))
+        return 0;
+      for (i = idx + 1; i < end && i < disk->sector_cnt; i++)
+        cache_zero (extent_sector (disk, i));
+      return extent_sector (disk, idx);
+    }
+
+  for (i = 0; ; i++)
+    {
+      struct extent e;
+
+      get_extent (disk, i, &e);
+      if (ofs < e.length)
+        return e.start != 0 ? e.start + ofs : fill_hole (disk, i, ofs);
+      ofs -= e.length;
+    }
+}
+
+/* Returns data sector IDX of the file whose inode is DISK, or 0
+   if it is not allocated.  If CREATE is true, allocates it first,
+   along with any index blocks or extents needed to name it, in
+   which case 0 means the disk is full.  Only index blocks and the
+   data sectors they name come zeroed.  The caller must
+   write DISK back if it changes. */
+static block_sector_t
+data_sector (struct inode_disk *disk, size_t idx, bool create)
+{
+  ASSERT (disk->magic != INLINE_MAGIC);
+  if (disk->magic != EXTENT_MAGIC)
+    return index_sector (disk, idx, create);
+  else if (create)
+    return extent_alloc (disk, idx);
+  else
+    return extent_sector (disk, idx);
+}
+
+/* Returns the number of sectors allocated to DISK, which uses
+   extents, not counting holes. */
+static size_t
+allocated_sectors (const struct inode_disk *disk)
+{
+  size_t cnt = 0;
+  size_t i;
+
+  for (i = 0; i < disk->extent_cnt; i++)
+    {
+      struct extent e;
+
+      get_extent (disk, i, &e);
+      if (e.start != 0)
+        cnt += e.length;
+    }
+  return cnt;
+}
+
+/* Allocates sectors for DISK, which uses extents, until its
+   extents cover SECTOR_CNT.  If it already has some allocated,
+   allocates more than asked, as many as it has up to
+   EXTENT_PREALLOC, so that a write after a long hole does not
+   preallocate much.  inode_close() frees what is left over.  Each
+   run extends the last extent in place if the sectors after it
+   are free, or else is the longest run available.  The sectors
+   are not zeroed: those past the end of the file hold whatever
+   was there before until inode_write_at() first writes them.
+   Returns false if the disk fills up. */
+static bool
+extend_extents (struct inode_disk *disk, size_t sector_cnt)
+{
+  size_t want, have;
+
+  if (disk->sector_cnt >= sector_cnt)
+    return true;
+  want = sector_cnt - disk->sector_cnt;
+  if (want < EXTENT_PREALLOC)
+    {
+      have = allocated_sectors (disk);
+      if (want < have)
+        want = have < EXTENT_PREALLOC ? have : EXTENT_PREALLOC;
+    }
+
+  while (want > 0)
+    {
+      struct extent e;
+      size_t cnt;
+
+      if (disk->extent_cnt > 0)
+        {
+          get_extent (disk, disk->extent_cnt - 1, &e);
+          cnt = (e.start != 0
+                 ? free_map_allocate_at (e.start + e.length, want) : 0);
+          if (cnt > 0)
+            {
+              e.length += cnt;
+              put_extent (disk, disk->extent_cnt - 1, &e);
+              disk->sector_cnt += cnt;
+              want -= cnt;
+              continue;
+            }
+        }
+
+      if (!free_map_allocate_run (want, &e.start, &cnt))
+        break;
+      e.length = cnt;
+      if (!put_extent (disk, disk->extent_cnt, &e))
+        {
+          free_map_release (e.start, cnt);
+          break;
+        }
+      disk->extent_cnt++;
+      disk->sector_cnt += cnt;
+      want -= cnt;
+    }
+  return disk->sector_cnt >= sector_cnt;
+}
+
+/* Frees the sectors of DISK, which uses extents, past the first
+   KEEP, and drops the extents that held them.  Returns true if
+   DISK changed, in which case the caller must write it back. */
+static bool
+trim_extents (struct inode_disk *disk, size_t keep)
+{
+  bool changed = false;
+
+  while (disk->sector_cnt > keep)
+    {
+      struct extent e;
+      size_t cut;
+
+      get_extent (disk, disk->extent_cnt - 1, &e);
+      cut = disk->sector_cnt - keep;
+      if (cut > e.length)
+        cut = e.length;
+      if (e.start != 0)
+        free_map_release (e.start + e.length - cut, cut);
+      e.length -= cut;
+      if (e.length > 0)
+        put_extent (disk, disk->extent_cnt - 1, &e);
+      else
+        disk->extent_cnt--;
+      disk->sector_cnt -= cut;
+      changed = true;
+    }
+  return changed;
+}
+
+/* Frees index block BLOCK and, if DEPTH > 0, all the sectors it
+   names, as index blocks of depth DEPTH - 1. */
+static void
+release_index (block_sector_t block, int depth)
+{
+  if (depth > 0)
+    {
+      block_sector_t sectors[PTRS_PER_SECTOR];
+      size_t i;
+
+      cache_read (block, sectors);
+      for (i = 0; i < PTRS_PER_SECTOR; i++)
+        if (sectors[i] != 0)
+          release_index (sectors[i], depth - 1);
+    }
+  free_map_release (block, 1);
+}
+
+/* Frees all the data and index sectors of DISK. */
+static void
+deallocate (struct inode_disk *disk)
+{
+  size_t i;
+
+  if (disk->magic == INLINE_MAGIC)
+    return;
+  if (disk->magic == EXTENT_MAGIC)
+    {
+      block_sector_t block = disk->overflow;
+
+      for (i = 0; i < disk->extent_cnt; i++)
+        {
+          struct extent e;
+          get_extent (disk, i, &e);
+          if (e.start != 0)
+            free_map_release (e.start, e.length);
+        }
+      while (block != 0)
+        {
+          block_sector_t next;
+          cache_read_at (block, &next, NEXT_OFS,
+                         sizeof next);
+          free_map_release (block, 1);
+          block = next;
+        }
+      return;
+    }
+
+  for (i = 0; i < DIRECT_CNT; i++)
+    if (disk->direct[i] != 0)
+      free_map_release (disk->direct[i], 1);
+  if (disk->indirect != 0)
+    release_index (disk->indirect, 1);
+  if (disk->doubly_indirect != 0)
+    release_index (disk->doubly_indirect, 2);
+}
+
+static block_sector_t find_sector (struct inode *, size_t idx);
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
+   Returns 0 if INODE does not contain data for a byte at offset
    POS. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
   ASSERT (inode != NULL);
   if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+    return find_sector (inode, pos / BLOCK_SECTOR_SIZE);
   else
-    return -1;
+    return 0;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Returns data sector IDX of INODE, or 0 if it is not allocated.
+   Filling a hole can move extents, so they are read with INODE's
+   lock held, which the caller may hold already.  Index blocks
+   only ever gain sectors, each zeroed before it is named, so they
+   are read without it. */
+static block_sector_t
+find_sector (struct inode *inode, size_t idx) 
+{
+  block_sector_t sector;
+
+  if (inode->data.magic != EXTENT_MAGIC
+      || lock_held_by_current_thread (&inode->lock))
+    return data_sector (&inode->data, idx, false);
+
+  lock_acquire (&inode->lock);
+  sector = data_sector (&inode->data, idx, false);
+  lock_release (&inode->lock);
+  return sector;
+}
+
+/* Table of open inodes, so that opening a single inode twice
+   returns the same `struct inode'.
+
+   The table also holds recently closed inodes, which have an
+   OPEN_CNT of 0 and are on closed_inodes, least recently closed
+   first.  Reopening one of these takes it back without reading
+   its sector.  An inode's in-memory DATA is written to disk
+   whenever it changes, so dropping a closed inode loses nothing.
+   At most CLOSED_MAX are kept, each for at most CLOSED_TICKS.
+   open_inodes_lock protects all of this. */
+static struct hash open_inodes;
+static struct list closed_inodes;
+static size_t closed_cnt;
+static struct lock open_inodes_lock;
+
+/* Most closed inodes to keep, and for how long. */
+#define CLOSED_MAX 64
+#define CLOSED_TICKS (30 * TIMER_FREQ)
+
+/* Statistics. */
+static long long open_call_cnt;         /* # of inode_open() calls. */
+static long long closed_hit_cnt;        /* # found closed. */
+static long long read_cnt;              /* # of inode sectors read. */
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
+static struct inode *lookup (block_sector_t);
+static void drop_closed (size_t max_cnt, int64_t min_ticks);
+static void free_inode (struct inode *);
+static void zero_gap (struct inode *, off_t offset);
+static bool move_inline (struct inode *);
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("can't allocate open inode table");
+  list_init (&closed_inodes);
+  lock_init (&open_inodes_lock);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The data is inline if it fits, or else a hole,
+   allocated only as it is written.
+   If PARENT is nonzero, the inode is a directory whose
+   parent directory's inode is in sector PARENT.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails or LENGTH is too big. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, block_sector_t parent)
 {
   struct inode_disk *disk_inode = NULL;
   bool success = false;
@@ -81,25 +735,24 @@ inode_create (block_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  ASSERT (sizeof (struct extent_block) == BLOCK_SECTOR_SIZE);
+
+  if (inode_format == INODE_INDEXED
+      && bytes_to_sectors (length) > MAX_SECTORS)
+    return false;
+
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
+      if (length <= INLINE_MAX)
+        disk_inode->magic = INLINE_MAGIC;
+      else
+        disk_inode->magic = (inode_format == INODE_EXTENTS
+                             ? EXTENT_MAGIC : INODE_MAGIC);
+      disk_inode->parent = parent;
       disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
+      cache_write (sector, disk_inode);
+      success = true; 
       free (disk_inode);
     }
   return success;
@@ -111,33 +764,59 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  lock_acquire (&open_inodes_lock);
+  open_call_cnt++;
+  drop_closed (CLOSED_MAX, timer_ticks () - CLOSED_TICKS);
+
+  /* Check whether this inode is open or recently closed, and
+     wait for its opener to read it in if need be. */
+  inode = lookup (sector);
+  if (inode != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
+      if (inode->open_cnt++ == 0)
         {
-          inode_reopen (inode);
-          return inode; 
+          list_remove (&inode->closed_elem);
+          closed_cnt--;
+          closed_hit_cnt++;
         }
+      while (inode->loading)
+        cond_wait (&inode->loaded, &open_inodes_lock);
+      lock_release (&open_inodes_lock);
+      return inode;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize, and enter the inode into the table marked as
+     loading, so that the read does not hold up other opens and
+     closes.  Other openers of the same inode wait for it. */
   inode->sector = sector;
   inode->open_cnt = 1;
+  inode->loading = true;
+  cond_init (&inode->loaded);
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  lock_init (&inode->lock);
+  lock_init (&inode->dir_lock);
+  inode->dir_cache = NULL;
+  hash_insert (&open_inodes, &inode->elem);
+  read_cnt++;
+  lock_release (&open_inodes_lock);
+
+  cache_read (inode->sector, &inode->data);
+
+  lock_acquire (&open_inodes_lock);
+  inode->loading = false;
+  cond_broadcast (&inode->loaded, &open_inodes_lock);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -146,7 +825,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -158,8 +841,9 @@ inode_get_inumber (const struct inode *inode)
 }
 
 /* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+   If this was the last reference to INODE, keeps it among the
+   recently closed inodes, or frees its memory and, if INODE was
+   also a removed inode, its blocks. */
 void
 inode_close (struct inode *inode) 
 {
@@ -167,22 +851,114 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
+  /* The last opener gives back the sectors preallocated past the
+     end of the file.  Staying open meanwhile keeps the inode from
+     being dropped, and its lock keeps out writers that reopen it. */
+  lock_acquire (&open_inodes_lock);
+  if (inode->open_cnt == 1 && !inode->removed
+      && inode->data.magic == EXTENT_MAGIC)
+    {
+      lock_release (&open_inodes_lock);
+      lock_acquire (&inode->lock);
+      if (trim_extents (&inode->data,
+                        bytes_to_sectors (inode->data.length)))
+        cache_write (inode->sector, &inode->data);
+      lock_release (&inode->lock);
+      lock_acquire (&open_inodes_lock);
+    }
+
   /* Release resources if this was the last opener. */
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
+      if (!inode->removed)
         {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          /* Keep it for a later reopen, making room first. */
+          inode->closed_ticks = timer_ticks ();
+          drop_closed (CLOSED_MAX - 1, inode->closed_ticks - CLOSED_TICKS);
+          list_push_back (&closed_inodes, &inode->closed_elem);
+          closed_cnt++;
+          lock_release (&open_inodes_lock);
+          return;
         }
 
-      free (inode); 
+      /* Remove from inode table and release lock. */
+      hash_delete (&open_inodes, &inode->elem);
+      lock_release (&open_inodes_lock);
+ 
+      /* Deallocate blocks. */
+      free_map_release (inode->sector, 1);
+      deallocate (&inode->data);
+      free_inode (inode);
     }
+  else
+    lock_release (&open_inodes_lock);
+}
+
+/* Prints inode statistics. */
+void
+inode_print_stats (void) 
+{
+  printf ("Inodes: %lld opens, %lld of recently closed inodes, "
+          "%lld sectors read\n", open_call_cnt, closed_hit_cnt, read_cnt);
+}
+
+/* Returns the inode in the table for SECTOR, or a null pointer
+   if there is none.  The caller must hold open_inodes_lock. */
+static struct inode *
+lookup (block_sector_t sector) 
+{
+  struct inode key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  return e != NULL ? hash_entry (e, struct inode, elem) : NULL;
+}
+
+/* Frees the least recently closed inodes until at most MAX_CNT
+   are left, along with any closed before MIN_TICKS.  The caller
+   must hold open_inodes_lock. */
+static void
+drop_closed (size_t max_cnt, int64_t min_ticks) 
+{
+  while (!list_empty (&closed_inodes))
+    {
+      struct inode *inode = list_entry (list_front (&closed_inodes),
+                                        struct inode, closed_elem);
+      if (closed_cnt <= max_cnt && inode->closed_ticks >= min_ticks)
+        break;
+      list_remove (&inode->closed_elem);
+      closed_cnt--;
+      hash_delete (&open_inodes, &inode->elem);
+      free_inode (inode);
+    }
+}
+
+/* Frees INODE's memory. */
+static void
+free_inode (struct inode *inode) 
+{
+  if (inode->dir_cache != NULL)
+    inode->free_dir_cache (inode->dir_cache);
+  free (inode);
+}
+
+/* Returns a hash value for the inode containing E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, elem);
+  return hash_int (inode->sector);
+}
+
+/* Returns true if inode A's sector is less than B's. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  const struct inode *ia = hash_entry (a, struct inode, elem);
+  const struct inode *ib = hash_entry (b, struct inode, elem);
+  return ia->sector < ib->sector;
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -194,6 +970,29 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Returns true if INODE has been removed, false otherwise. */
+bool
+inode_is_removed (const struct inode *inode) 
+{
+  return inode->removed;
+}
+
+/* Returns true if INODE is a directory, false otherwise. */
+bool
+inode_is_dir (const struct inode *inode) 
+{
+  return inode->data.parent != 0;
+}
+
+/* Returns the sector of the inode of directory INODE's parent
+   directory. */
+block_sector_t
+inode_get_parent (const struct inode *inode) 
+{
+  ASSERT (inode_is_dir (inode));
+  return inode->data.parent;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
@@ -202,7 +1001,24 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+
+  if (inode->data.magic == INLINE_MAGIC)
+    {
+      lock_acquire (&inode->lock);
+      if (inode->data.magic == INLINE_MAGIC)
+        {
+          if (offset < inode->data.length)
+            {
+              bytes_read = inode->data.length - offset;
+              if (bytes_read > size)
+                bytes_read = size;
+              memcpy (buffer, inode->data.inline_data + offset, bytes_read);
+            }
+          lock_release (&inode->lock);
+          return bytes_read;
+        }
+      lock_release (&inode->lock);
+    }
 
   while (size > 0) 
     {
@@ -220,59 +1036,91 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      if (sector_idx != 0)
+        cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                       chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
 
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or the file reaches its
+   largest possible size.
+   A write past end of file extends it, leaving any gap between
+   the old end and OFFSET as a hole that reads as zeros. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  off_t length = inode_length (inode);
+  bool locked = false;
+  bool changed = false;
+  bool fresh;
 
   if (inode->deny_write_cnt)
     return 0;
 
+  /* Write inline data in place, unless the write does not fit,
+     in which case the data moves out first. */
+  if (size > 0 && inode->data.magic == INLINE_MAGIC)
+    {
+      lock_acquire (&inode->lock);
+      locked = true;
+      if (inode->data.magic == INLINE_MAGIC)
+        {
+          if (offset + size <= INLINE_MAX)
+            {
+              memcpy (inode->data.inline_data + offset, buffer, size);
+              if (offset + size > inode->data.length)
+                inode->data.length = offset + size;
+              cache_write (inode->sector, &inode->data);
+              lock_release (&inode->lock);
+              return size;
+            }
+          if (!move_inline (inode))
+            {
+              lock_release (&inode->lock);
+              return 0;
+            }
+          changed = true;
+        }
+    }
+
+  /* Growing the file, or allocating a sector in a hole, holds the
+     lock until done.  The new length takes effect only once the
+     data is written, so that readers never see the file grow
+     before its contents do. */
+  if (size > 0 && offset + size > length)
+    {
+      if (!locked)
+        {
+          lock_acquire (&inode->lock);
+          locked = true;
+        }
+      length = offset + size;
+      zero_gap (inode, offset);
+    }
+
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      size_t idx = offset / BLOCK_SECTOR_SIZE;
+      block_sector_t sector_idx = find_sector (inode, idx);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left = length - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -281,49 +1129,141 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
+      /* Allocate the sector on its first write. */
+      fresh = sector_idx == 0 || idx >= bytes_to_sectors (inode->data.length);
+      if (sector_idx == 0)
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
+          if (!locked)
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
+              lock_acquire (&inode->lock);
+              locked = true;
             }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+          sector_idx = data_sector (&inode->data, idx, true);
+          if (sector_idx == 0)
+            break;
+          changed = true;
         }
 
+      /* The cache reads in the rest of the sector first if the
+         chunk does not cover all of it.  A sector from extents
+         that was never written holds stale data instead, so the
+         rest of it is zeroed. */
+      if (fresh && chunk_size < BLOCK_SECTOR_SIZE
+          && inode->data.magic == EXTENT_MAGIC)
+        cache_zero (sector_idx);
+      cache_write_at (sector_idx, buffer + bytes_written, sector_ofs,
+                      chunk_size);
+
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
 
+  if (locked)
+    {
+      if (bytes_written > 0 && offset > inode->data.length)
+        {
+          inode->data.length = offset;
+          changed = true;
+        }
+      if (changed)
+        cache_write (inode->sector, &inode->data);
+      lock_release (&inode->lock);
+    }
   return bytes_written;
 }
 
+/* Zeros the sectors of INODE from its end up to the one holding
+   OFFSET, which a write is about to extend it to.  Only extents
+   allocate sectors past the end of a file, so with index blocks
+   those sectors are all holes already.  The caller must hold
+   INODE's lock. */
+static void
+zero_gap (struct inode *inode, off_t offset)
+{
+  size_t idx = bytes_to_sectors (inode->data.length);
+  size_t end = offset / BLOCK_SECTOR_SIZE;
+
+  if (inode->data.magic != EXTENT_MAGIC)
+    return;
+  if (end > inode->data.sector_cnt)
+    end = inode->data.sector_cnt;
+  for (; idx < end; idx++)
+    {
+      block_sector_t sector = extent_sector (&inode->data, idx);
+      if (sector != 0)
+        cache_zero (sector);
+    }
+}
+
+/* Moves the data of INODE, which is held inline, to a sector of
+   its own, and gives INODE the format of new inodes.  Returns
+   false if the disk is full.  The caller must hold INODE's lock
+   and write INODE back. */
+static bool
+move_inline (struct inode *inode)
+{
+  struct inode_disk *disk = &inode->data;
+  block_sector_t sector = 0;
+
+  if (disk->length > 0)
+    {
+      if (!free_map_allocate (1, &sector))
+        return false;
+      cache_zero (sector);
+      cache_write_at (sector, disk->inline_data, 0, disk->length);
+    }
+
+  memset (disk->inline_data, 0, sizeof disk->inline_data);
+  if (inode_format == INODE_EXTENTS)
+    {
+      if (sector != 0)
+        {
+          disk->extents[0].start = sector;
+          disk->extents[0].length = 1;
+          disk->extent_cnt = disk->sector_cnt = 1;
+        }
+    }
+  else
+    disk->direct[0] = sector;
+
+  /* Readers check the magic number without the lock, so it must
+     not change before the rest. */
+  barrier ();
+  disk->magic = inode_format == INODE_EXTENTS ? EXTENT_MAGIC : INODE_MAGIC;
+  return true;
+}
+
+/* Asks for the sectors holding the SIZE bytes of INODE starting
+   at OFFSET to be read into the cache in the background. */
+void
+inode_readahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+
+  if (inode->data.magic == INLINE_MAGIC)
+    return;
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  offset = offset / BLOCK_SECTOR_SIZE * BLOCK_SECTOR_SIZE;
+  for (; offset < end; offset += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, offset);
+      if (sector != 0)
+        cache_readahead (sector);
+    }
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode) 
 {
+  lock_acquire (&inode->lock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  lock_release (&inode->lock);
 }
 
 /* Re-enables writes to INODE.
@@ -332,9 +1272,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  lock_acquire (&inode->lock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  lock_release (&inode->lock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -347,4 +1289,48 @@ inode_length (const struct inode *inode)
 bool 
 inode_get_deny_write (const struct inode *inode) {
   return inode->deny_write_cnt;
-}
\ No newline at end of file
+}
+/* Returns the on-disk format of INODE's data. */
+enum inode_format
+inode_get_format (const struct inode *inode)
+{
+  return inode->data.magic == EXTENT_MAGIC ? INODE_EXTENTS : INODE_INDEXED;
+}
+
+/* Acquires INODE's directory lock, which serializes lookups and
+   updates of the entries of the directory it holds. */
+void
+inode_lock_dir (struct inode *inode)
+{
+  lock_acquire (&inode->dir_lock);
+}
+
+/* Releases INODE's directory lock. */
+void
+inode_unlock_dir (struct inode *inode)
+{
+  lock_release (&inode->dir_lock);
+}
+
+/* Returns the state that the directory module keeps for INODE,
+   or a null pointer if it has none.  The caller must hold
+   INODE's directory lock. */
+void *
+inode_get_dir_cache (struct inode *inode)
+{
+  ASSERT (lock_held_by_current_thread (&inode->dir_lock));
+  return inode->dir_cache;
+}
+
+/* Sets CACHE as the state that the directory module keeps for
+   INODE, for as long as INODE is in memory.  FREE_CACHE is called
+   to free it.  The caller must hold INODE's directory lock. */
+void
+inode_set_dir_cache (struct inode *inode, void *cache,
+                     void (*free_cache) (void *))
+{
+  ASSERT (lock_held_by_current_thread (&inode->dir_lock));
+  ASSERT (inode->dir_cache == NULL);
+  inode->dir_cache = cache;
+  inode->free_dir_cache = free_cache;
+}
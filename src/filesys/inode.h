@@ -7,18 +7,40 @@
 
 struct bitmap;
 
+/* On-disk formats for the data of an inode. */
+enum inode_format
+  {
+    INODE_INDEXED,              /* Direct and indirect index blocks. */
+    INODE_EXTENTS               /* Runs of consecutive sectors. */
+  };
+
+/* Format for new inodes, which filesys_init() sets to that of
+   the root directory unless formatting.
+   Set by kernel command-line option "-extents". */
+extern enum inode_format inode_format;
+
 void inode_init (void);
-bool inode_create (block_sector_t, off_t);
+bool inode_create (block_sector_t, off_t, block_sector_t parent);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
+bool inode_is_removed (const struct inode *);
+bool inode_is_dir (const struct inode *);
+block_sector_t inode_get_parent (const struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+void inode_readahead (struct inode *, off_t offset, off_t size);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
 bool inode_get_deny_write (const struct inode *);
+enum inode_format inode_get_format (const struct inode *);
+void inode_lock_dir (struct inode *);
+void inode_unlock_dir (struct inode *);
+void *inode_get_dir_cache (struct inode *);
+void inode_set_dir_cache (struct inode *, void *, void (*) (void *));
+void inode_print_stats (void);
 
 #endif /* filesys/inode.h */
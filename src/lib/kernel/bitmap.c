@@ -60,6 +60,62 @@ byte_cnt (size_t bit_cnt)
   return sizeof (elem_type) * elem_cnt (bit_cnt);
 }
 
+/* Returns the index of the first bit of the element after the
+   one that contains the bit numbered BIT_IDX. */
+static inline size_t
+next_elem (size_t bit_idx)
+{
+  return (elem_idx (bit_idx) + 1) * ELEM_BITS;
+}
+
+/* Returns a mask of the bits in the element containing bit START
+   that lie between START and END, exclusive, which must be
+   greater than START. */
+static inline elem_type
+range_mask (size_t start, size_t end)
+{
+  size_t ofs = start % ELEM_BITS;
+  size_t n = end - start < ELEM_BITS - ofs ? end - start : ELEM_BITS - ofs;
+  elem_type low = n < ELEM_BITS ? ((elem_type) 1 << n) - 1 : (elem_type) -1;
+  return low << ofs;
+}
+
+/* Returns element E if VALUE is true, its complement otherwise,
+   so that the bits set in the result are those equal to VALUE. */
+static inline elem_type
+match (elem_type e, bool value)
+{
+  return value ? e : ~e;
+}
+
+/* Returns the number of 1-bits in E. */
+static inline size_t
+popcount (elem_type e)
+{
+  const elem_type ones = (elem_type) -1;
+
+  e = e - ((e >> 1) & (ones / 3));
+  e = (e & (ones / 15 * 3)) + ((e >> 2) & (ones / 15 * 3));
+  e = (e + (e >> 4)) & (ones / 255 * 15);
+  return (e * (ones / 255)) >> (sizeof (elem_type) - 1) * CHAR_BIT;
+}
+
+/* Returns the index of the first bit in B at or after START, and
+   before END, that is set to VALUE, or END if there is none. */
+static size_t
+next_match (const struct bitmap *b, size_t start, size_t end, bool value)
+{
+  size_t i;
+
+  for (i = start; i < end; i = next_elem (i))
+    {
+      elem_type e = match (b->bits[elem_idx (i)], value) & range_mask (i, end);
+      if (e != 0)
+        return elem_idx (i) * ELEM_BITS + __builtin_ctzl (e);
+    }
+  return end;
+}
+
 /* Returns a bit mask in which the bits actually used in the last
    element of B's bits are set to 1 and the rest are set to 0. */
 static inline elem_type
@@ -213,18 +269,29 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Each element is updated atomically. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
+  size_t end = start + cnt;
   size_t i;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  for (i = start; i < end; i = next_elem (i))
+    {
+      elem_type *e = &b->bits[elem_idx (i)];
+      elem_type mask = range_mask (i, end);
+
+      /* See bitmap_mark() and bitmap_reset(). */
+      if (value)
+        asm ("orl %1, %0" : "=m" (*e) : "r" (mask) : "cc");
+      else
+        asm ("andl %1, %0" : "=m" (*e) : "r" (~mask) : "cc");
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -232,6 +299,7 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
+  size_t end = start + cnt;
   size_t i, value_cnt;
 
   ASSERT (b != NULL);
@@ -239,9 +307,9 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (start + cnt <= b->bit_cnt);
 
   value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
+  for (i = start; i < end; i = next_elem (i))
+    value_cnt += popcount (match (b->bits[elem_idx (i)], value)
+                           & range_mask (i, end));
   return value_cnt;
 }
 
@@ -250,16 +318,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return next_match (b, start, start + cnt, value) != start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -291,22 +354,33 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Works a word at a time: each step skips to the next bit set to
+   VALUE, then to the first bit after it that is not, so a run of
+   bits that cannot start a group is passed over whole. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
+  size_t i;
+
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt) 
+  if (cnt == 0)
+    return start;
+  for (i = start; ; )
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t run_end;
+
+      i = next_match (b, i, b->bit_cnt, value);
+      if (b->bit_cnt - i < cnt)
+        return BITMAP_ERROR;
+      run_end = next_match (b, i, i + cnt, !value);
+      if (run_end == i + cnt)
+        return i;
+      i = run_end;
     }
-  return BITMAP_ERROR;
 }
 
 /* Finds the first group of CNT consecutive bits in B at or after
@@ -358,6 +432,24 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes to FILE only the bytes of B that hold the CNT bits
+   starting at START, at the same offset that bitmap_write()
+   would put them.  Return true if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t start, size_t cnt)
+{
+  off_t ofs, size;
+
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (start + cnt <= b->bit_cnt);
+
+  ofs = start / CHAR_BIT;
+  size = DIV_ROUND_UP (start + cnt, CHAR_BIT) - ofs;
+  return (file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs)
+          == size);
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -0,0 +1,12 @@
+#ifndef __LIB_MADVISE_H
+#define __LIB_MADVISE_H
+
+/* Values for madvise()'s ADVICE argument, describing how a
+   process will use a range of its memory. */
+#define MADV_NORMAL 0           /* No particular pattern. */
+#define MADV_RANDOM 1           /* Random order: no readahead. */
+#define MADV_SEQUENTIAL 2       /* In increasing order, once. */
+#define MADV_WILLNEED 3         /* Soon: start reading it in now. */
+#define MADV_DONTNEED 4         /* Not any more: discard it. */
+
+#endif /* lib/madvise.h */
@@ -0,0 +1,20 @@
+#ifndef __LIB_RUSAGE_H
+#define __LIB_RUSAGE_H
+
+/* Memory and paging counters of a process, as returned by the
+   getrusage() system call. */
+struct rusage
+  {
+    long long minor_faults;     /* Page faults served without I/O. */
+    long long major_faults;     /* Page faults that read a file or swap. */
+    long long swap_outs;        /* Pages written out to swap. */
+    long long paging_bytes;     /* Bytes read to serve page faults. */
+    int resident_pages;         /* Pages currently in memory. */
+    int max_resident_pages;     /* Peak of resident_pages. */
+  };
+
+/* Values for getrusage()'s WHO argument. */
+#define RUSAGE_SELF 0           /* The calling process. */
+#define RUSAGE_CHILDREN 1       /* All its children it has waited for. */
+
+#endif /* lib/rusage.h */
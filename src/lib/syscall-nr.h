@@ -28,7 +28,13 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_GETRUSAGE,              /* Report memory and paging counters. */
+    SYS_MADVISE,                /* Advise on use of a memory range. */
+    SYS_BRK,                    /* Moves the end of the heap. */
+    SYS_YIELD                   /* Gives up the CPU. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -0,0 +1,383 @@
+#include <malloc.h>
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+
+/* A malloc() for user programs, on top of sbrk().
+
+   Small requests are rounded up to one of a set of size classes,
+   spaced about a quarter apart so that little memory is lost to
+   rounding.  Each class keeps a singly linked free list, used
+   last in, first out, so that the most recently freed block,
+   likely still in the cache, is the next one handed out.  An
+   empty list is refilled by carving a fresh page, called an
+   "arena", into blocks of the class.  Small blocks are never
+   given back to the kernel.
+
+   Requests too big for a page are given whole pages of their
+   own, headed by an arena that records their number.  A freed
+   run of pages merges with any free runs next to it.  Free runs
+   at the top of the heap are returned with sbrk(); others go on
+   a free list, in address order, for reuse, with their memory
+   released to the kernel by madvise() until then. */
+
+/* Size of a page. */
+#define PAGE_SIZE 4096
+
+/* Magic number for detecting arena corruption. */
+#define ARENA_MAGIC 0x9a548eed
+
+/* Arena class of a run of pages for one big block. */
+#define BIG_CLASS 0xff
+
+/* Header at the start of every arena. */
+struct arena
+  {
+    unsigned magic;             /* Always set to ARENA_MAGIC. */
+    uint8_t class;              /* Size class, or BIG_CLASS. */
+    size_t page_cnt;            /* Pages in a big block's run. */
+    struct arena *next;         /* Next free run of pages. */
+  };
+
+/* Free small block. */
+struct block
+  {
+    struct block *next;         /* Next free block of the class. */
+  };
+
+/* Size classes, in bytes. */
+static const size_t class_sizes[] =
+  {
+    16, 32, 48, 64, 80, 96, 112, 128,
+    160, 192, 224, 256, 320, 384, 448, 512,
+    640, 768, 896, 1024, 1280, 1536, 1792, 2016,
+  };
+#define CLASS_CNT (sizeof class_sizes / sizeof *class_sizes)
+
+/* Largest small block. */
+#define MAX_SMALL 2016
+
+/* Class for each request size, indexed by size / 16 rounded
+   up. */
+static uint8_t size_to_class[MAX_SMALL / 16 + 1];
+
+/* Free small blocks of each class, and free runs of pages in
+   address order. */
+static struct block *free_lists[CLASS_CNT];
+static struct arena *free_runs;
+
+static bool initialized;
+
+static void init (void);
+static struct block *refill (size_t class);
+static void *big_alloc (size_t size);
+static void big_free (struct arena *);
+static bool trim_heap (void);
+static uint8_t *run_end (struct arena *);
+static struct arena *get_pages (size_t page_cnt);
+static struct arena *block_to_arena (void *);
+
+/* Obtains and returns a new block of at least SIZE bytes.
+   Returns a null pointer if memory is not available. */
+void *
+malloc (size_t size)
+{
+  struct block *b;
+  size_t class;
+
+  if (size == 0)
+    return NULL;
+  if (size > MAX_SMALL)
+    return big_alloc (size);
+  if (!initialized)
+    init ();
+
+  class = size_to_class[DIV_ROUND_UP (size, 16)];
+  b = free_lists[class];
+  if (b == NULL)
+    return refill (class);
+  free_lists[class] = b->next;
+  return b;
+}
+
+/* Allocates and return A times B bytes initialized to zeroes.
+   Returns a null pointer if memory is not available. */
+void *
+calloc (size_t a, size_t b)
+{
+  void *p;
+
+  if (b != 0 && a > SIZE_MAX / b)
+    return NULL;
+  p = malloc (a * b);
+  if (p != NULL)
+    memset (p, 0, a * b);
+  return p;
+}
+
+/* Returns the number of bytes allocated for BLOCK. */
+static size_t
+block_size (void *block)
+{
+  struct arena *a = block_to_arena (block);
+
+  if (a->class == BIG_CLASS)
+    return a->page_cnt * PAGE_SIZE - sizeof *a;
+  return class_sizes[a->class];
+}
+
+/* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
+   moving it in the process.
+   If successful, returns the new block; on failure, returns a
+   null pointer.
+   A call with null OLD_BLOCK is equivalent to malloc(NEW_SIZE).
+   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK). */
+void *
+realloc (void *old_block, size_t new_size)
+{
+  void *new_block;
+  size_t old_size;
+
+  if (new_size == 0)
+    {
+      free (old_block);
+      return NULL;
+    }
+  if (old_block == NULL)
+    return malloc (new_size);
+
+  old_size = block_size (old_block);
+  if (new_size <= old_size)
+    return old_block;
+  new_block = malloc (new_size);
+  if (new_block != NULL)
+    {
+      memcpy (new_block, old_block, old_size);
+      free (old_block);
+    }
+  return new_block;
+}
+
+/* Frees block P, which must have been previously allocated with
+   malloc(), calloc(), or realloc(). */
+void
+free (void *p)
+{
+  struct arena *a;
+  struct block *b = p;
+
+  if (p == NULL)
+    return;
+
+  a = block_to_arena (p);
+  if (a->class == BIG_CLASS)
+    big_free (a);
+  else
+    {
+      b->next = free_lists[a->class];
+      free_lists[a->class] = b;
+    }
+}
+
+/* Fills in size_to_class[]. */
+static void
+init (void)
+{
+  size_t i, class = 0;
+
+  for (i = 0; i < sizeof size_to_class; i++)
+    {
+      while (class_sizes[class] < i * 16)
+        class++;
+      size_to_class[i] = class;
+    }
+  initialized = true;
+}
+
+/* Carves a new arena into blocks of CLASS, puts all but the
+   first on the class's free list, and returns the first.
+   Returns a null pointer if memory is not available. */
+static struct block *
+refill (size_t class)
+{
+  size_t size = class_sizes[class];
+  size_t cnt = (PAGE_SIZE - sizeof (struct arena)) / size;
+  struct arena *a;
+  uint8_t *first;
+  size_t i;
+
+  a = get_pages (1);
+  if (a == NULL)
+    return NULL;
+  a->class = class;
+
+  /* Link the blocks from last to first, so that they are handed
+     out in address order. */
+  first = (uint8_t *) (a + 1);
+  for (i = cnt; i-- > 1; )
+    {
+      struct block *b = (struct block *) (first + i * size);
+      b->next = free_lists[class];
+      free_lists[class] = b;
+    }
+  return (struct block *) first;
+}
+
+/* Returns a big block of at least SIZE bytes on pages of its
+   own, or a null pointer if memory is not available. */
+static void *
+big_alloc (size_t size)
+{
+  struct arena **best = NULL;
+  struct arena **ap;
+  struct arena *a;
+  size_t page_cnt;
+
+  if (size > SIZE_MAX - PAGE_SIZE)
+    return NULL;
+  page_cnt = DIV_ROUND_UP (size + sizeof *a, PAGE_SIZE);
+
+  /* Best fit among the free runs. */
+  for (ap = &free_runs; *ap != NULL; ap = &(*ap)->next)
+    if ((*ap)->page_cnt >= page_cnt
+        && (best == NULL || (*ap)->page_cnt < (*best)->page_cnt))
+      best = ap;
+
+  if (best != NULL)
+    {
+      a = *best;
+      if (a->page_cnt > page_cnt)
+        {
+          /* Leave the rest of the run free. */
+          struct arena *rest = (struct arena *) ((uint8_t *) a
+                                                 + page_cnt * PAGE_SIZE);
+          rest->magic = ARENA_MAGIC;
+          rest->class = BIG_CLASS;
+          rest->page_cnt = a->page_cnt - page_cnt;
+          rest->next = a->next;
+          *best = rest;
+          a->page_cnt = page_cnt;
+        }
+      else
+        *best = a->next;
+    }
+  else
+    {
+      a = get_pages (page_cnt);
+      if (a == NULL)
+        return NULL;
+      a->class = BIG_CLASS;
+      a->page_cnt = page_cnt;
+    }
+  return a + 1;
+}
+
+/* Frees the run of pages headed by arena A, merging it with the
+   free runs on either side. */
+static void
+big_free (struct arena *a)
+{
+  struct arena *prev = NULL;
+  struct arena *next = free_runs;
+  uint8_t *release = (uint8_t *) a + PAGE_SIZE;
+  uint8_t *release_end = run_end (a);
+
+  /* Find A's place in free_runs. */
+  while (next != NULL && next < a)
+    {
+      prev = next;
+      next = next->next;
+    }
+
+  /* Merge.  A header that ends up inside a run is released along
+     with A's pages. */
+  if (next != NULL && (uint8_t *) next == run_end (a))
+    {
+      a->page_cnt += next->page_cnt;
+      next = next->next;
+      release_end += PAGE_SIZE;
+    }
+  a->next = next;
+  if (prev != NULL && run_end (prev) == (uint8_t *) a)
+    {
+      prev->page_cnt += a->page_cnt;
+      prev->next = next;
+      release = (uint8_t *) a;
+      a = prev;
+    }
+  else if (prev != NULL)
+    prev->next = a;
+  else
+    free_runs = a;
+
+  /* Keep only the header page in memory, unless the run can go
+     back to the kernel. */
+  if ((run_end (a) != sbrk (0) || !trim_heap ()) && release < release_end)
+    madvise (release, release_end - release, MADV_DONTNEED);
+}
+
+/* Returns free runs at the top of the heap to the kernel with
+   sbrk(), for as long as the top run is free.  Returns true if
+   any was returned. */
+static bool
+trim_heap (void)
+{
+  bool trimmed = false;
+
+  for (;;)
+    {
+      struct arena **last = NULL;
+      struct arena **ap;
+      struct arena *a;
+
+      for (ap = &free_runs; *ap != NULL; ap = &(*ap)->next)
+        last = ap;
+      if (last == NULL)
+        return trimmed;
+      a = *last;
+      if (run_end (a) != sbrk (0)
+          || sbrk (-(intptr_t) (a->page_cnt * PAGE_SIZE)) == (void *) -1)
+        return trimmed;
+      *last = NULL;
+      trimmed = true;
+    }
+}
+
+/* Returns the end of the run of pages headed by arena A. */
+static uint8_t *
+run_end (struct arena *a)
+{
+  return (uint8_t *) a + a->page_cnt * PAGE_SIZE;
+}
+
+/* Extends the heap by PAGE_CNT page-aligned pages and returns
+   them, headed by an arena with only its magic number set, or a
+   null pointer if memory is not available. */
+static struct arena *
+get_pages (size_t page_cnt)
+{
+  uint8_t *old_break = sbrk (0);
+  size_t pad = (ROUND_UP ((uintptr_t) old_break, PAGE_SIZE)
+                - (uintptr_t) old_break);
+  struct arena *a;
+
+  if (page_cnt > (SIZE_MAX - pad) / PAGE_SIZE
+      || sbrk (pad + page_cnt * PAGE_SIZE) == (void *) -1)
+    return NULL;
+  a = (struct arena *) (old_break + pad);
+  a->magic = ARENA_MAGIC;
+  return a;
+}
+
+/* Returns the arena that block P is in. */
+static struct arena *
+block_to_arena (void *p)
+{
+  struct arena *a = (struct arena *) ((uintptr_t) p & ~(PAGE_SIZE - 1));
+
+  ASSERT (a != NULL);
+  ASSERT (a->magic == ARENA_MAGIC);
+  return a;
+}
@@ -182,3 +182,39 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+bool
+getrusage (int who, struct rusage *usage)
+{
+  return syscall2 (SYS_GETRUSAGE, who, usage);
+}
+
+bool
+madvise (void *addr, size_t length, int advice)
+{
+  return syscall3 (SYS_MADVISE, addr, length, advice);
+}
+
+bool
+brk (void *end)
+{
+  return (void *) syscall1 (SYS_BRK, end) == end;
+}
+
+void *
+sbrk (intptr_t increment)
+{
+  char *old_break = (char *) syscall1 (SYS_BRK, NULL);
+
+  if (increment != 0
+      && (char *) syscall1 (SYS_BRK, old_break + increment)
+         != old_break + increment)
+    return (void *) -1;
+  return old_break;
+}
+
+void
+yield (void)
+{
+  syscall0 (SYS_YIELD);
+}
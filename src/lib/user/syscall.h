@@ -2,7 +2,11 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <debug.h>
+#include <madvise.h>
+#include <rusage.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -45,4 +49,11 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+bool getrusage (int who, struct rusage *);
+bool madvise (void *addr, size_t length, int advice);
+bool brk (void *end);
+void *sbrk (intptr_t increment);
+void yield (void);
+
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,187 @@
+/* Test program for lib/kernel/bitmap.c.
+
+   Checks bitmap_scan(), bitmap_count(), bitmap_contains(), and
+   bitmap_set_multiple(), which work a word at a time, against
+   straightforward bit-at-a-time versions built on bitmap_test(),
+   over random ranges of randomly filled bitmaps.  Then times
+   scans of large bitmaps that are nearly full and nearly empty.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/test.h"
+
+/* Size of the bitmaps used for checking, in bits.  Not a
+   multiple of the word size, to exercise the last word. */
+#define CHECK_BITS 1021
+
+/* Size of the bitmaps used for timing, in bits. */
+#define BENCH_BITS (1024 * 1024)
+
+/* Number of random operations checked per fill density. */
+#define CHECK_ITERS 2000
+
+static void fill (struct bitmap *, unsigned density);
+static void random_range (const struct bitmap *, size_t *start, size_t *cnt);
+static size_t ref_count (const struct bitmap *, size_t, size_t, bool);
+static bool ref_contains (const struct bitmap *, size_t, size_t, bool);
+static size_t ref_scan (const struct bitmap *, size_t, size_t, bool);
+static void check (unsigned density);
+static void bench (const char *name, unsigned density);
+
+/* Test the bitmap implementation. */
+void
+test (void)
+{
+  unsigned density;
+
+  printf ("checking bitmaps of %d bits:", CHECK_BITS);
+  for (density = 0; density <= 100; density += 10)
+    {
+      printf (" %u%%", density);
+      check (density);
+    }
+  printf (" done\n");
+
+  bench ("empty", 0);
+  bench ("sparse", 1);
+  bench ("dense", 99);
+  bench ("full", 100);
+  printf ("bitmap: PASS\n");
+}
+
+/* Sets each bit in B with probability DENSITY percent. */
+static void
+fill (struct bitmap *b, unsigned density)
+{
+  size_t i;
+
+  for (i = 0; i < bitmap_size (b); i++)
+    bitmap_set (b, i, random_ulong () % 100 < density);
+}
+
+/* Returns a random (START, CNT) range within B. */
+static void
+random_range (const struct bitmap *b, size_t *start, size_t *cnt)
+{
+  *start = random_ulong () % (bitmap_size (b) + 1);
+  *cnt = random_ulong () % (bitmap_size (b) - *start + 1);
+  if (random_ulong () % 2)
+    *cnt %= 80;
+}
+
+/* Checks the bitmap functions over random operations on a bitmap
+   filled to DENSITY percent. */
+static void
+check (unsigned density)
+{
+  struct bitmap *b = bitmap_create (CHECK_BITS);
+  int iter;
+
+  ASSERT (b != NULL);
+  fill (b, density);
+  for (iter = 0; iter < CHECK_ITERS; iter++)
+    {
+      bool value = random_ulong () % 2;
+      size_t start, cnt, i;
+
+      random_range (b, &start, &cnt);
+      ASSERT (bitmap_count (b, start, cnt, value)
+              == ref_count (b, start, cnt, value));
+      ASSERT (bitmap_contains (b, start, cnt, value)
+              == ref_contains (b, start, cnt, value));
+      ASSERT (bitmap_scan (b, start, cnt % 12, value)
+              == ref_scan (b, start, cnt % 12, value));
+
+      /* Now and then, change a range and check every bit. */
+      if (iter % 16 == 0)
+        {
+          struct bitmap *old = bitmap_create (CHECK_BITS);
+
+          ASSERT (old != NULL);
+          for (i = 0; i < CHECK_BITS; i++)
+            bitmap_set (old, i, bitmap_test (b, i));
+          bitmap_set_multiple (b, start, cnt, value);
+          for (i = 0; i < CHECK_BITS; i++)
+            ASSERT (bitmap_test (b, i) == (i >= start && i < start + cnt
+                                           ? value : bitmap_test (old, i)));
+          bitmap_destroy (old);
+        }
+    }
+  bitmap_destroy (b);
+}
+
+/* Times scans for single false bits and for runs of 8, and a
+   full count, on a large bitmap filled to DENSITY percent. */
+static void
+bench (const char *name, unsigned density)
+{
+  struct bitmap *b = bitmap_create (BENCH_BITS);
+  uint64_t start;
+  size_t cnt;
+  int i;
+
+  ASSERT (b != NULL);
+  fill (b, density);
+
+  start = timer_cycles ();
+  for (i = 0; i < 16; i++)
+    bitmap_scan (b, random_ulong () % BENCH_BITS, 1, false);
+  printf ("%s: scan(1) %llu cycles, ", name,
+          (timer_cycles () - start) / 16);
+
+  start = timer_cycles ();
+  for (i = 0; i < 16; i++)
+    bitmap_scan (b, random_ulong () % BENCH_BITS, 8, false);
+  printf ("scan(8) %llu cycles, ", (timer_cycles () - start) / 16);
+
+  start = timer_cycles ();
+  cnt = bitmap_count (b, 0, BENCH_BITS, true);
+  printf ("count %llu cycles\n", timer_cycles () - start);
+  ASSERT (cnt == ref_count (b, 0, BENCH_BITS, true));
+
+  bitmap_destroy (b);
+}
+
+/* Returns the number of bits in B in [START, START + CNT) set to
+   VALUE, one bit at a time. */
+static size_t
+ref_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t i, n = 0;
+
+  for (i = start; i < start + cnt; i++)
+    if (bitmap_test (b, i) == value)
+      n++;
+  return n;
+}
+
+/* Returns true if any bit in B in [START, START + CNT) is set to
+   VALUE, one bit at a time. */
+static bool
+ref_contains (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  return ref_count (b, start, cnt, value) > 0;
+}
+
+/* Returns the first index at or after START of CNT bits in B
+   all set to VALUE, trying every starting index. */
+static size_t
+ref_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t i;
+
+  if (cnt > bitmap_size (b))
+    return BITMAP_ERROR;
+  for (i = start; i <= bitmap_size (b) - cnt; i++)
+    if (!ref_contains (b, i, cnt, !value))
+      return i;
+  return BITMAP_ERROR;
+}
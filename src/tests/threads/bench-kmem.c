@@ -0,0 +1,54 @@
+/* Touches one byte in each of many kernel pages, round after
+   round, and reports the cycles per touch.  With more than a
+   few hundred pages the 4 kB TLB entries run out, so comparing
+   a run with -nopse to one without, with enough RAM for large
+   pages beyond the first 4 MB (e.g. "pintos -m 64"), shows what
+   mapping kernel memory with large pages saves.
+
+   Not graded: run it with "pintos -- run bench-kmem". */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
+
+/* Pages to touch, at most. */
+#define PAGE_CNT 1024
+
+/* Passes over all the pages. */
+#define ROUNDS 64
+
+void
+test_bench_kmem (void)
+{
+  static uint8_t *pages[PAGE_CNT];
+  size_t page_cnt, i;
+  uint64_t start, cycles;
+  int round;
+
+  for (page_cnt = 0; page_cnt < PAGE_CNT; page_cnt++)
+    {
+      pages[page_cnt] = palloc_get_page (0);
+      if (pages[page_cnt] == NULL)
+        break;
+    }
+  if (page_cnt == 0)
+    fail ("no free kernel pages");
+
+  /* Offsetting each page's byte spreads the touches across cache
+     sets, so that TLB misses dominate. */
+  start = timer_cycles ();
+  for (round = 0; round < ROUNDS; round++)
+    for (i = 0; i < page_cnt; i++)
+      pages[i][(i * 64) % PGSIZE]++;
+  cycles = timer_cycles () - start;
+
+  msg ("%zu pages, %d rounds: %llu cycles per touch",
+       page_cnt, ROUNDS, cycles / (page_cnt * ROUNDS));
+
+  for (i = 0; i < page_cnt; i++)
+    palloc_free_page (pages[i]);
+  pass ();
+}
@@ -34,8 +34,17 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/inode.h"
+#endif
+#ifdef VM
+#include "vm/evict.h"
+#include "vm/frame.h"
+#include "vm/merge.h"
+#include "vm/page.h"
+#include "vm/swap.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -57,6 +66,12 @@ static const char *swap_bdev_name;
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+/* -nopse: Map all of kernel memory with 4 kB pages? */
+static bool small_pages_only;
+
+/* -nopge: Flush kernel TLB entries on every address space switch? */
+static bool no_global_pages;
+
 static void bss_init (void);
 static void paging_init (void);
 
@@ -98,6 +113,9 @@ main (void)
   palloc_init (user_page_limit);
   malloc_init ();
   paging_init ();
+#ifdef VM
+  frame_init ();
+#endif
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -127,6 +145,14 @@ main (void)
   filesys_init (format_filesys);
 #endif
 
+#ifdef VM
+  /* Initialize paging to swap. */
+  swap_init ();
+  evict_init ();
+  page_init ();
+  merge_init ();
+#endif
+
   printf ("Boot complete.\n");
   
   /* Run actions specified on kernel command line. */
@@ -150,20 +176,66 @@ bss_init (void)
   memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* CR4 bits, and the CPUID feature flags that say the CPU has
+   them.  See [IA32-v3a] 2.5 "Control Registers". */
+#define CR4_PSE 0x00000010      /* Page Size Extensions. */
+#define CR4_PGE 0x00000080      /* Page Global Enable. */
+#define CPUID_PSE (1 << 3)      /* CPUID leaf 1, EDX. */
+#define CPUID_PGE (1 << 13)     /* CPUID leaf 1, EDX. */
+
+/* Returns the feature flags in EDX of CPUID leaf 1. */
+static uint32_t
+cpu_features (void)
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  return edx;
+}
+
+/* Returns the bits of control register CR4. */
+static uint32_t
+cr4_get (void)
+{
+  uint32_t cr4;
+
+  asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+  return cr4;
+}
+
+/* Sets control register CR4 to CR4. */
+static void
+cr4_set (uint32_t cr4)
+{
+  asm volatile ("movl %0, %%cr4" : : "r" (cr4) : "memory");
+}
+
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   Each 4 MB of RAM is mapped by a single large page if the CPU
+   supports them, saving a page table and TLB entries, except
+   where the kernel's text must be made read-only a page at a
+   time, or RAM ends partway. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
   size_t page;
   extern char _start, _end_kernel_text;
+  uintptr_t text_start = vtop (&_start);
+  uintptr_t text_end = vtop (&_end_kernel_text);
+  bool large_pages = !small_pages_only && (cpu_features () & CPUID_PSE);
+
+  if (large_pages)
+    cr4_set (cr4_get () | CR4_PSE);
 
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   pt = NULL;
-  for (page = 0; page < init_ram_pages; page++)
+  page = 0;
+  while (page < init_ram_pages)
     {
       uintptr_t paddr = page * PGSIZE;
       char *vaddr = ptov (paddr);
@@ -171,6 +243,15 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      if (large_pages && pte_idx == 0
+          && page + PTSPAN / PGSIZE <= init_ram_pages
+          && (paddr + PTSPAN <= text_start || paddr >= text_end))
+        {
+          pd[pde_idx] = pde_create_large (vaddr, true);
+          page += PTSPAN / PGSIZE;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
@@ -178,6 +259,7 @@ paging_init (void)
         }
 
       pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
+      page++;
     }
 
   /* Store the physical address of the page directory into CR3
@@ -186,6 +268,11 @@ paging_init (void)
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
      of the Page Directory". */
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
+
+  /* Honor the global bit in the kernel's PTEs, so that switching
+     between processes does not flush the kernel from the TLB. */
+  if (!no_global_pages && (cpu_features () & CPUID_PGE))
+    cr4_set (cr4_get () | CR4_PGE);
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -247,6 +334,14 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-extents"))
+        inode_format = INODE_EXTENTS;
+      else if (!strcmp (name, "-cache"))
+        cache_sectors = atoi (value);
+      else if (!strcmp (name, "-flush"))
+        cache_flush_msecs = atoi (value);
+      else if (!strcmp (name, "-ra"))
+        cache_readahead_max = atoi (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -256,9 +351,28 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-nopse"))
+        small_pages_only = true;
+      else if (!strcmp (name, "-nopge"))
+        no_global_pages = true;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+      else if (!strcmp (name, "-rusage"))
+        process_print_rusage = true;
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-sl"))
+        stack_page_limit = atoi (value);
+      else if (!strcmp (name, "-zswap"))
+        zswap_pages = atoi (value);
+      else if (!strcmp (name, "-evict"))
+        {
+          if (!evict_select (value))
+            PANIC ("unknown page replacement policy `%s'", value);
+        }
+      else if (!strcmp (name, "-merge"))
+        merge_batch = atoi (value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -373,14 +487,32 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -extents           With -f, store file data in extents.\n"
+          "  -cache=COUNT       Cache COUNT file system sectors (default 64).\n"
+          "  -flush=MSEC        Write back dirty sectors every MSEC ms\n"
+          "                     (default 1000, 0=write through).\n"
+          "  -ra=COUNT          Read ahead up to COUNT sectors of files read\n"
+          "                     sequentially (default 32, 0=off).\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -nopse             Map kernel memory with 4 kB pages only.\n"
+          "  -nopge             Flush kernel TLB entries on process switches.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+          "  -rusage            Print each process's paging counters at exit.\n"
+#endif
+#ifdef VM
+          "  -sl=COUNT          Limit user stacks to COUNT pages.\n"
+          "  -evict=POLICY      Replace pages by POLICY: clock (default),\n"
+          "                     eclock, lru or 2q.\n"
+          "  -zswap=COUNT       Keep swapped pages compressed in COUNT pages of\n"
+          "                     kernel memory before disk (default 64, 0=off).\n"
+          "  -merge=COUNT       Merge identical pages, checking COUNT frames\n"
+          "                     5 times a second (default 32, 0=off).\n"
 #endif
           );
   shutdown_power_off ();
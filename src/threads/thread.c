@@ -11,6 +11,7 @@
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 #include "filesys/filesys.h"
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -54,6 +55,9 @@ struct kernel_thread_frame
 static long long idle_ticks;    /* # of timer ticks spent idle. */
 static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
 static long long user_ticks;    /* # of timer ticks in user programs. */
+static long long switch_cnt;    /* # of context switches. */
+static uint64_t switch_cycles;  /* Time spent switching. */
+static uint64_t switch_start;   /* When the current switch began. */
 
 /* The minimum sleep ticks */
 static int64_t min_sleep_ticks;
@@ -328,6 +332,8 @@ thread_print_stats (void)
 {
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+  printf ("Thread: %lld context switches, %llu cycles each\n",
+          switch_cnt, switch_cnt > 0 ? switch_cycles / switch_cnt : 0);
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -794,6 +800,7 @@ init_thread (struct thread *t, const char *name, int priority)
   t->recent_cpu = RECENT_CPU_DEFAULT;
 
   t->parent_tid = 0;
+  t->cwd = NULL;
   t->exit_status = -1;
   list_init(&t->children);
   lock_init(&t->exit_lock);
@@ -865,6 +872,12 @@ thread_schedule_tail (struct thread *prev)
   process_activate ();
 #endif
 
+  if (prev != NULL)
+    {
+      switch_cnt++;
+      switch_cycles += timer_cycles () - switch_start;
+    }
+
   /* If the thread we switched from is dying, destroy its struct
      thread.  This must happen late so that thread_exit() doesn't
      pull out the rug under itself.  (We don't free
@@ -899,7 +912,10 @@ schedule (void)
   ASSERT (is_thread (next));
 
   if (cur != next)
-    prev = switch_threads (cur, next);
+    {
+      switch_start = timer_cycles ();
+      prev = switch_threads (cur, next);
+    }
   thread_schedule_tail (prev);
 }
 
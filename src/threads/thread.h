@@ -2,7 +2,9 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <hash.h>
 #include <list.h>
+#include <rusage.h>
 #include <stdint.h>
 #include "synch.h"
 #include "filesys/filesys.h"
@@ -128,10 +130,26 @@ struct thread
     /* For file descriptors */
     struct file *fdt[MAX_FILE];         /* The file descriptor table*/
     int next_fd;
+    struct dir *cwd;                    /* Current directory, null for root. */
 
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+    struct rusage rusage;               /* Memory and paging counters. */
+    struct rusage child_rusage;         /* Sum over waited-for children. */
+    uint8_t *heap_start;                /* Start of the heap, page-aligned. */
+    uint8_t *heap_break;                /* End of the heap, set by brk(). */
+#endif
+
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct hash pages;                  /* Supplemental page table. */
+    struct file *exec_file;             /* Executable, for loading pages. */
+    void *user_esp;                     /* User stack pointer at syscall entry. */
+    struct lock pages_lock;             /* Excludes vm-prefetch from pages. */
+    struct list_elem prefetch_elem;     /* Element in the prefetch queue. */
+    uint8_t *prefetch_next;             /* Next page to prefetch. */
+    uint8_t *prefetch_end;              /* End of pages to prefetch. */
 #endif
 
     /* Owned by thread.c. */
@@ -144,6 +162,7 @@ struct tstart_properties {
    char *args;                         /* The arguments to be parsed */
    struct semaphore wait;              /* The semaphore to wait for starting */
    struct thread *this_thread;         /* The pointer to this thread */
+   struct dir *cwd;                    /* Parent's current directory. */
 };
 
 /* If false (default), use round-robin scheduler.
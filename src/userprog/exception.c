@@ -4,6 +4,10 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -160,6 +164,16 @@ page_fault (struct intr_frame *f)
   kill (f);
   */
 
+#ifdef VM
+  /* Let the virtual memory system bring the page in, if it can.
+     A fault in the kernel on user memory happens during a system
+     call, so the user stack pointer is the one saved on entry. */
+  if (is_user_vaddr (fault_addr)
+      && page_handle_fault (fault_addr, not_present, write,
+                            user ? f->esp : thread_current ()->user_esp))
+    return;
+#endif
+
   /* If crashes in user space, just kill it */
   if(user) {
     struct thread* cur_thread = thread_current();
@@ -1,18 +1,26 @@
 #include "userprog/pagedir.h"
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 
+/* Number of times a page directory was loaded into CR3. */
+static long long pd_loads;
+
 static uint32_t *active_pd (void);
-static void invalidate_pagedir (uint32_t *);
+static void invalidate_page (uint32_t *, const void *vpage);
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
    Returns the new page directory, or a null pointer if memory
-   allocation fails. */
+   allocation fails.
+
+   The kernel mappings are the same page tables as in
+   init_page_dir, whose entries are global, so that they survive
+   in the TLB when the CPU switches to this page directory. */
 uint32_t *
 pagedir_create (void) 
 {
@@ -23,7 +31,8 @@ pagedir_create (void)
 }
 
 /* Destroys page directory PD, freeing all the pages it
-   references. */
+   references.  With virtual memory, user frames belong to the
+   supplemental page table, which must release them first. */
 void
 pagedir_destroy (uint32_t *pd) 
 {
@@ -37,11 +46,13 @@ pagedir_destroy (uint32_t *pd)
     if (*pde & PTE_P) 
       {
         uint32_t *pt = pde_get_pt (*pde);
+#ifndef VM
         uint32_t *pte;
         
         for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
           if (*pte & PTE_P) 
             palloc_free_page (pte_get_page (*pte));
+#endif
         palloc_free_page (pt);
       }
   palloc_free_page (pd);
@@ -152,7 +163,7 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      invalidate_page (pd, upage);
     }
 }
 
@@ -180,7 +191,7 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
       else 
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -209,18 +220,53 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
       else 
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
+        }
+    }
+}
+
+/* Returns true if the PTE for virtual page VPAGE in PD is marked
+   copy-on-write, that is, if the page is logically writable but
+   mapped read-only to a frame it shares with other mappings.
+   Returns false if PD contains no PTE for VPAGE. */
+bool
+pagedir_is_cow (uint32_t *pd, const void *vpage) 
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  return pte != NULL && (*pte & PTE_COW) != 0;
+}
+
+/* Sets the copy-on-write mark to COW in the PTE for virtual page
+   VPAGE in PD.  Marking a page copy-on-write also makes it
+   read-only, so that the first write to it faults. */
+void
+pagedir_set_cow (uint32_t *pd, const void *vpage, bool cow) 
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  if (pte != NULL) 
+    {
+      if (cow)
+        {
+          *pte = (*pte | PTE_COW) & ~(uint32_t) PTE_W;
+          invalidate_page (pd, vpage);
         }
+      else 
+        *pte &= ~(uint32_t) PTE_COW;
     }
 }
 
 /* Loads page directory PD into the CPU's page directory base
-   register. */
+   register, unless it is already loaded.  Loading flushes the
+   user mappings from the TLB, but not the kernel's, which are
+   global. */
 void
 pagedir_activate (uint32_t *pd) 
 {
   if (pd == NULL)
     pd = init_page_dir;
+  if (pd == active_pd ())
+    return;
+  pd_loads++;
 
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
@@ -243,21 +289,28 @@ active_pd (void)
   return ptov (pd);
 }
 
+/* Prints page directory statistics. */
+void
+pagedir_print_stats (void)
+{
+  printf ("Page directories: %lld loads\n", pd_loads);
+}
+
 /* Seom page table changes can cause the CPU's translation
    lookaside buffer (TLB) to become out-of-sync with the page
-   table.  When this happens, we have to "invalidate" the TLB by
-   re-activating it.
+   table.  When this happens, we have to "invalidate" the TLB
+   entry for the page that changed.
 
-   This function invalidates the TLB if PD is the active page
-   directory.  (If PD is not active then its entries are not in
-   the TLB, so there is no need to invalidate anything.) */
+   This function invalidates VPAGE's TLB entry if PD is the
+   active page directory.  (If PD is not active then its entries
+   are not in the TLB, so there is no need to invalidate
+   anything.) */
 static void
-invalidate_pagedir (uint32_t *pd) 
+invalidate_page (uint32_t *pd, const void *vpage) 
 {
   if (active_pd () == pd) 
     {
-      /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
-         "Translation Lookaside Buffers (TLBs)". */
-      pagedir_activate (pd);
+      /* See [IA32-v2a] "INVLPG--Invalidate TLB Entry". */
+      asm volatile ("invlpg (%0)" : : "r" (vpage) : "memory");
     } 
 }
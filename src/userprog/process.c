@@ -17,9 +17,18 @@
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 static thread_func start_process NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
+static void rusage_accumulate (struct rusage *, const struct rusage *);
+static bool add_heap_page (void *upage);
+static void remove_heap_page (void *upage);
+
+/* Print each process's resource usage when it exits? */
+bool process_print_rusage;
 
 static const MAX_ARR_SIZE = 128;
 
@@ -45,6 +54,7 @@ process_execute (const char *file_name)
   /* Parse command line and get program name */
   tstart.file_name = strtok_r(fn_copy, " ", &tstart.args);
   tstart.parent_tid = cur_thread->tid;
+  tstart.cwd = cur_thread->cwd;
 
   /* Create a new thread to execute FILE_NAME and wait. */
   sema_init(&tstart.wait, 0);
@@ -126,6 +136,11 @@ start_process (void *aux)
     return TID_ERROR;
   strlcpy (fn_copy, file_name, PGSIZE);
 
+  /* Start in the parent's current directory.  The parent waits
+     for us, so it stays open until we have our own. */
+  if (tstart->cwd != NULL)
+    thread_current ()->cwd = dir_reopen (tstart->cwd);
+
   /* Initialize interrupt frame and load executable. */
   memset (&if_, 0, sizeof if_);
   if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
@@ -208,6 +223,8 @@ process_wait (tid_t child_tid)
     lock_release (&child->exit_lock);
     
     int exit_status = child->exit_status;
+    rusage_accumulate (&cur->child_rusage, &child->rusage);
+    rusage_accumulate (&cur->child_rusage, &child->child_rusage);
     palloc_free_page (child);
 
     return exit_status;
@@ -224,6 +241,14 @@ process_exit (void)
   struct thread *cur = thread_current ();
   uint32_t *pd;
 
+  if (process_print_rusage && cur->pagedir != NULL)
+    printf ("%s: rusage: %lld minor faults, %lld major faults, "
+            "%d pages peak resident, %lld swap-outs, "
+            "%lld bytes paged in\n",
+            cur->name, cur->rusage.minor_faults, cur->rusage.major_faults,
+            cur->rusage.max_resident_pages, cur->rusage.swap_outs,
+            cur->rusage.paging_bytes);
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
@@ -235,12 +260,21 @@ process_exit (void)
        directory before destroying the process's page
        directory, or our active page directory will be one
        that's been freed (and cleared). */
+#ifdef VM
+    page_table_destroy ();
+#endif
     cur->pagedir = NULL;
     pagedir_activate (NULL);
     pagedir_destroy (pd);
   }
 
+#ifdef VM
+  close_reopened_file (cur->exec_file);
+  cur->exec_file = NULL;
+#endif
   close_all_files();
+  dir_close (cur->cwd);
+  cur->cwd = NULL;
   
   // printf("ACQUIRING THE LOCK 2...\n");
   lock_acquire (&cur->exit_lock);
@@ -287,6 +321,110 @@ process_exit (void)
   // intr_set_level (old_level);
 }
 
+/* Stores into *USAGE the memory and paging counters of the
+   running process if WHO is RUSAGE_SELF, or the totals over the
+   children it has waited for if WHO is RUSAGE_CHILDREN.  Counts
+   are kept only with virtual memory.  Returns false if WHO is
+   invalid. */
+bool
+process_get_rusage (int who, struct rusage *usage)
+{
+  struct thread *cur = thread_current ();
+
+  if (who == RUSAGE_SELF)
+    *usage = cur->rusage;
+  else if (who == RUSAGE_CHILDREN)
+    *usage = cur->child_rusage;
+  else
+    return false;
+  return true;
+}
+
+/* Adds the counters in ADD to SUM.  Resident pages are not
+   summed: only the peak is kept. */
+static void
+rusage_accumulate (struct rusage *sum, const struct rusage *add)
+{
+  sum->minor_faults += add->minor_faults;
+  sum->major_faults += add->major_faults;
+  sum->swap_outs += add->swap_outs;
+  sum->paging_bytes += add->paging_bytes;
+  if (add->max_resident_pages > sum->max_resident_pages)
+    sum->max_resident_pages = add->max_resident_pages;
+}
+
+/* Moves the running process's heap break to END, mapping
+   zeroed pages as it grows and unmapping them as it shrinks.
+   The heap cannot shrink below its start or grow into the
+   stack.  Returns the break afterward, which is unchanged if END
+   is out of range or memory runs out; a null END just returns
+   the break. */
+void *
+process_set_break (void *end_)
+{
+  struct thread *cur = thread_current ();
+  uint8_t *end = end_;
+  uint8_t *old_top = pg_round_up (cur->heap_break);
+  uint8_t *new_top = pg_round_up (end);
+  uint8_t *limit;
+  uint8_t *upage;
+
+#ifdef VM
+  limit = (uint8_t *) PHYS_BASE - stack_page_limit * PGSIZE;
+#else
+  limit = (uint8_t *) PHYS_BASE - PGSIZE;
+#endif
+  if (end < cur->heap_start || end > limit)
+    return cur->heap_break;
+
+  for (upage = old_top; upage < new_top; upage += PGSIZE)
+    if (!add_heap_page (upage))
+      {
+        while (upage > old_top)
+          remove_heap_page (upage -= PGSIZE);
+        return cur->heap_break;
+      }
+  for (upage = new_top; upage < old_top; upage += PGSIZE)
+    remove_heap_page (upage);
+  cur->heap_break = end;
+  return end;
+}
+
+/* Maps a zeroed, writable heap page at UPAGE.  With virtual
+   memory, nothing is allocated until it is touched. */
+static bool
+add_heap_page (void *upage)
+{
+#ifdef VM
+  return page_add_zero (upage, true);
+#else
+  uint8_t *kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+  if (kpage == NULL)
+    return false;
+  if (!pagedir_set_page (thread_current ()->pagedir, upage, kpage, true))
+    {
+      palloc_free_page (kpage);
+      return false;
+    }
+  return true;
+#endif
+}
+
+/* Unmaps heap page UPAGE and frees its memory. */
+static void
+remove_heap_page (void *upage)
+{
+#ifdef VM
+  page_remove (upage);
+#else
+  uint32_t *pd = thread_current ()->pagedir;
+  void *kpage = pagedir_get_page (pd, upage);
+
+  pagedir_clear_page (pd, upage);
+  palloc_free_page (kpage);
+#endif
+}
+
 /* Sets up the CPU for running user code in the current
    thread.
    This function is called on every context switch. */
@@ -295,8 +433,11 @@ process_activate (void)
 {
   struct thread *t = thread_current ();
 
-  /* Activate thread's page tables. */
-  pagedir_activate (t->pagedir);
+  /* Activate thread's page tables.  A kernel thread uses only
+     kernel mappings, which every page directory has, so it keeps
+     whichever one is loaded. */
+  if (t->pagedir != NULL)
+    pagedir_activate (t->pagedir);
 
   /* Set thread's kernel stack for use in processing
      interrupts. */
@@ -387,9 +528,18 @@ load (const char *file_name, void (**eip) (void), void **esp)
   int i;
 
   /* Allocate and activate page directory. */
+  t->heap_start = NULL;
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL) 
     goto done;
+#ifdef VM
+  if (!page_table_create ())
+    {
+      pagedir_destroy (t->pagedir);
+      t->pagedir = NULL;
+      goto done;
+    }
+#endif
   process_activate ();
 
   /* Open executable file. */
@@ -398,6 +548,14 @@ load (const char *file_name, void (**eip) (void), void **esp)
     printf ("load: %s: open failed\n", file_name);
     goto done; 
   }
+#ifdef VM
+  /* Pages are loaded from a private reference to the file, which
+     the program cannot close. */
+  t->exec_file = reopen_file(fd, true);
+  if(t->exec_file == NULL) {
+    goto done;
+  }
+#endif
 
   /* Read and verify executable header. */
   if (read_file(fd, &ehdr, sizeof ehdr) != sizeof ehdr
@@ -464,6 +622,11 @@ load (const char *file_name, void (**eip) (void), void **esp)
               if (!load_segment (fd, file_page, (void *) mem_page,
                                  read_bytes, zero_bytes, writable))
                 goto done;
+
+              /* The heap starts past the highest segment. */
+              if ((uint8_t *) mem_page + read_bytes + zero_bytes
+                  > t->heap_start)
+                t->heap_start = (uint8_t *) mem_page + read_bytes + zero_bytes;
             }
           else
             goto done;
@@ -471,6 +634,8 @@ load (const char *file_name, void (**eip) (void), void **esp)
         }
     }
 
+  t->heap_break = t->heap_start;
+
   /* Set up stack. */
   if (!setup_stack (esp))
     goto done;
@@ -488,7 +653,12 @@ load (const char *file_name, void (**eip) (void), void **esp)
 
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+static bool load_page (int fd, off_t ofs, void *upage, size_t read_bytes,
+                       bool writable);
+static void *read_user_page (int fd, off_t ofs, size_t read_bytes);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -550,14 +720,13 @@ validate_segment (const struct Elf32_Phdr *phdr, int fd)
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
 static bool
-load_segment (int fd, off_t ofs, uint8_t *upage,
+load_segment (int fd UNUSED, off_t ofs, uint8_t *upage,
               uint32_t read_bytes, uint32_t zero_bytes, bool writable) 
 {
   ASSERT ((read_bytes + zero_bytes) % PGSIZE == 0);
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
-  seek_file(fd, ofs);
   while (read_bytes > 0 || zero_bytes > 0) 
     {
       /* Calculate how to fill this page.
@@ -565,30 +734,23 @@ load_segment (int fd, off_t ofs, uint8_t *upage,
          and zero the final PAGE_ZERO_BYTES bytes. */
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-      /* Get a page of memory. */
-      uint8_t *kpage = palloc_get_page (PAL_USER);
-      if (kpage == NULL)
+      bool success;
+
+      /* Load this page.  With virtual memory it is only
+         recorded, to be read in on its first access. */
+#ifdef VM
+      success = page_add_file (upage, thread_current ()->exec_file, ofs,
+                               page_read_bytes, writable);
+#else
+      success = load_page (fd, ofs, upage, page_read_bytes, writable);
+#endif
+      if (!success)
         return false;
 
-      /* Load this page. */
-      if (read_file(fd, kpage, page_read_bytes) != (int) page_read_bytes)
-        {
-          palloc_free_page (kpage);
-          return false; 
-        }
-      memset (kpage + page_read_bytes, 0, page_zero_bytes);
-
-      /* Add the page to the process's address space. */
-      if (!install_page (upage, kpage, writable)) 
-        {
-          palloc_free_page (kpage);
-          return false; 
-        }
-
       /* Advance. */
       read_bytes -= page_read_bytes;
       zero_bytes -= page_zero_bytes;
+      ofs += PGSIZE;
       upage += PGSIZE;
     }
   return true;
@@ -599,21 +761,64 @@ load_segment (int fd, off_t ofs, uint8_t *upage,
 static bool
 setup_stack (void **esp) 
 {
-  uint8_t *kpage;
+  uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
   bool success = false;
 
-  kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+#ifdef VM
+  success = page_add_zero (upage, true);
+#else
+  uint8_t *kpage = palloc_get_page (PAL_USER | PAL_ZERO);
   if (kpage != NULL) 
     {
-      success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
-      if (success)
-        *esp = PHYS_BASE;
-      else
+      success = install_page (upage, kpage, true);
+      if (!success)
         palloc_free_page (kpage);
     }
+#endif
+  if (success)
+    *esp = PHYS_BASE;
   return success;
 }
 
+#ifndef VM
+/* Maps UPAGE to a page holding the READ_BYTES bytes at offset OFS
+   in the file open as FD, followed by zeros. */
+static bool
+load_page (int fd, off_t ofs, void *upage, size_t read_bytes,
+           bool writable)
+{
+  uint8_t *kpage = read_user_page (fd, ofs, read_bytes);
+  if (kpage == NULL)
+    return false;
+
+  if (!install_page (upage, kpage, writable)) 
+    {
+      palloc_free_page (kpage);
+      return false; 
+    }
+  return true;
+}
+
+/* Returns a new user page holding the READ_BYTES bytes at offset
+   OFS in the file open as FD, followed by zeros, or a null
+   pointer if memory allocation or the read fails. */
+static void *
+read_user_page (int fd, off_t ofs, size_t read_bytes)
+{
+  uint8_t *kpage = palloc_get_page (PAL_USER);
+  if (kpage == NULL)
+    return NULL;
+
+  seek_file(fd, ofs);
+  if (read_file(fd, kpage, read_bytes) != (int) read_bytes)
+    {
+      palloc_free_page (kpage);
+      return NULL; 
+    }
+  memset (kpage + read_bytes, 0, PGSIZE - read_bytes);
+  return kpage;
+}
+
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -633,3 +838,4 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
@@ -9,6 +9,12 @@ tid_t process_execute (const char *file_name);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
+bool process_get_rusage (int who, struct rusage *);
+void *process_set_break (void *end);
+
+/* Print each process's resource usage when it exits?
+   Controlled by kernel command-line option "-rusage". */
+extern bool process_print_rusage;
 
 void argument_stack(int, char**, void**);
 
@@ -8,9 +8,13 @@
 #include "threads/palloc.h"
 #include <string.h>
 #include "userprog/process.h"
+#include "filesys/directory.h"
 #include "filesys/filesys.h"
 #include "lib/stdio.h"
 #include "lib/kernel/stdio.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 #define SET_RETURN_VALUE(x) f->eax = x
 
@@ -21,6 +25,8 @@ static void syscall_handler (struct intr_frame *);
 static int get_user(const uint8_t*);
 static bool put_user(uint8_t*, uint8_t);
 static void error_exit(struct intr_frame*);
+static bool pin_buffer(const void*, unsigned, bool);
+static void unpin_buffer(const void*, unsigned);
 static int get_argc(void*);
 static void *get_args(void *);
 
@@ -48,6 +54,15 @@ static void file_size(const void *, struct intr_frame*);
 static void seek(const void *, struct intr_frame*);
 static void tell(const void *, struct intr_frame*);
 static void close(const void *, struct intr_frame*);
+static void chdir(const void *, struct intr_frame*);
+static void mkdir(const void *, struct intr_frame*);
+static void readdir(const void *, struct intr_frame*);
+static void isdir(const void *, struct intr_frame*);
+static void inumber(const void *, struct intr_frame*);
+static void getrusage(const void *, struct intr_frame*);
+static void madvise(const void *, struct intr_frame*);
+static void brk(const void *, struct intr_frame*);
+static void yield(void);
 
 void
 syscall_init (void) 
@@ -64,6 +79,12 @@ syscall_handler (struct intr_frame *f)
   void *stack_pointer = f->esp;
   int number;
 
+#ifdef VM
+  /* Page faults taken on user memory during the call need the
+     user stack pointer to recognize stack accesses. */
+  thread_current()->user_esp = f->esp;
+#endif
+
   if(!get_arg_int(stack_pointer, 0, &number)) {
     error_exit(f);
   }
@@ -114,6 +135,33 @@ syscall_handler (struct intr_frame *f)
     case SYS_CLOSE:
       close(args, f);
       break;
+    case SYS_CHDIR:
+      chdir(args, f);
+      break;
+    case SYS_MKDIR:
+      mkdir(args, f);
+      break;
+    case SYS_READDIR:
+      readdir(args, f);
+      break;
+    case SYS_ISDIR:
+      isdir(args, f);
+      break;
+    case SYS_INUMBER:
+      inumber(args, f);
+      break;
+    case SYS_GETRUSAGE:
+      getrusage(args, f);
+      break;
+    case SYS_MADVISE:
+      madvise(args, f);
+      break;
+    case SYS_BRK:
+      brk(args, f);
+      break;
+    case SYS_YIELD:
+      yield();
+      break;
     default:
       error_exit(f);
       break;
@@ -257,6 +305,27 @@ error_exit(struct intr_frame *f) {
   thread_exit();
 }
 
+/* Keep a user buffer resident while the file system works on it.
+   Paging it back in may need the file system lock, so it must not
+   fault while that lock is held.  WRITE means the kernel will
+   store into it. */
+static bool
+pin_buffer(const void *buffer UNUSED, unsigned size UNUSED,
+           bool write UNUSED) {
+#ifdef VM
+  return page_pin_buffer(buffer, size, write);
+#else
+  return true;
+#endif
+}
+
+/* Release a buffer pinned by pin_buffer() */
+static void
+unpin_buffer(const void *buffer UNUSED, unsigned size UNUSED) {
+#ifdef VM
+  page_unpin_buffer(buffer, size);
+#endif
+}
 
 /** Shutdown pintos */
 static void
@@ -308,33 +377,39 @@ create(const void *args, struct intr_frame *f) {
   char *name;
   off_t initial_size;
 
-  if (!get_arg_str(args, 0, &name) || !get_arg_int(args, 1, &initial_size)) {
+  if (!get_arg_str(args, 0, &name) || !get_arg_int(args, 1, &initial_size) ||
+      !pin_buffer(name, strlen(name) + 1, false)) {
     error_exit(f);
   }
 
   SET_RETURN_VALUE(create_file(name, initial_size));
+  unpin_buffer(name, strlen(name) + 1);
 }
 
 static void
 remove(const void *args, struct intr_frame *f) {
   char *name;
 
-  if (!get_arg_str(args, 0, &name)) {
+  if (!get_arg_str(args, 0, &name) ||
+      !pin_buffer(name, strlen(name) + 1, false)) {
     error_exit(f);
   }
 
   SET_RETURN_VALUE(remove_file(name));
+  unpin_buffer(name, strlen(name) + 1);
 }
 
 static void
 open(const void *args, struct intr_frame *f) {
   char *file_name;
 
-  if(!get_arg_str(args, 0, &file_name)) {
+  if(!get_arg_str(args, 0, &file_name) ||
+     !pin_buffer(file_name, strlen(file_name) + 1, false)) {
     error_exit(f);
   }
   
   SET_RETURN_VALUE(open_file(file_name, false));
+  unpin_buffer(file_name, strlen(file_name) + 1);
 }
 
 static void
@@ -347,12 +422,14 @@ read(const void *args, struct intr_frame *f) {
      !get_arg_ptr(args, 1, &buffer) ||
      !get_arg_int(args, 2, &size) ||
      get_user(buffer) == -1 ||
-     get_user(buffer + size) == -1
+     get_user(buffer + size) == -1 ||
+     !pin_buffer(buffer, size, true)
   ) {
     error_exit(f);
   }
 
   SET_RETURN_VALUE(read_file(fd, buffer, size));
+  unpin_buffer(buffer, size);
 }
 
 /* Write something */
@@ -366,12 +443,14 @@ write(const void *args, struct intr_frame *f) {
      !get_arg_ptr(args, 1, &buffer) || 
      !get_arg_int(args, 2, &size) ||
      get_user(buffer) == -1 ||
-     get_user(buffer + size) == -1
+     get_user(buffer + size) == -1 ||
+     !pin_buffer(buffer, size, false)
   ) {
     error_exit(f);
   }
 
   SET_RETURN_VALUE(write_to_file(fd, buffer, size));
+  unpin_buffer(buffer, size);
 }
 
 static void
@@ -419,4 +498,140 @@ close(const void *args, struct intr_frame *f) {
   }
   close_file(fd);
   SET_RETURN_VALUE(0);
-}
\ No newline at end of file
+}
+
+/* Change the current directory */
+static void
+chdir(const void *args, struct intr_frame *f) {
+  char *dir;
+
+  if (!get_arg_str(args, 0, &dir) ||
+      !pin_buffer(dir, strlen(dir) + 1, false)) {
+    error_exit(f);
+  }
+
+  SET_RETURN_VALUE(change_dir(dir));
+  unpin_buffer(dir, strlen(dir) + 1);
+}
+
+/* Create a directory */
+static void
+mkdir(const void *args, struct intr_frame *f) {
+  char *dir;
+
+  if (!get_arg_str(args, 0, &dir) ||
+      !pin_buffer(dir, strlen(dir) + 1, false)) {
+    error_exit(f);
+  }
+
+  SET_RETURN_VALUE(make_dir(dir));
+  unpin_buffer(dir, strlen(dir) + 1);
+}
+
+/* Copy the next entry of a directory out to the user */
+static void
+readdir(const void *args, struct intr_frame *f) {
+  int fd;
+  uint8_t *buffer;
+  char name[NAME_MAX + 1];
+
+  if(!get_arg_int(args, 0, &fd) || !get_arg_ptr(args, 1, &buffer)) {
+    error_exit(f);
+  }
+
+  if(!read_dir(fd, name)) {
+    SET_RETURN_VALUE(false);
+    return;
+  }
+
+  for(unsigned i = 0; i <= strlen(name); i++) {
+    if(!put_user(buffer + i, name[i])) {
+      error_exit(f);
+    }
+  }
+  SET_RETURN_VALUE(true);
+}
+
+/* Whether a file descriptor is a directory */
+static void
+isdir(const void *args, struct intr_frame *f) {
+  int fd;
+
+  if(!get_arg_int(args, 0, &fd)) {
+    error_exit(f);
+  }
+
+  SET_RETURN_VALUE(is_dir_file(fd));
+}
+
+/* The inode number of a file descriptor */
+static void
+inumber(const void *args, struct intr_frame *f) {
+  int fd;
+
+  if(!get_arg_int(args, 0, &fd)) {
+    error_exit(f);
+  }
+
+  SET_RETURN_VALUE(get_file_inumber(fd));
+}
+/* Copy memory and paging counters out to the user */
+static void
+getrusage(const void *args, struct intr_frame *f) {
+  int who;
+  uint8_t *buffer;
+  struct rusage usage;
+
+  if(!get_arg_int(args, 0, &who) || !get_arg_ptr(args, 1, &buffer)) {
+    error_exit(f);
+  }
+
+  if(!process_get_rusage(who, &usage)) {
+    SET_RETURN_VALUE(false);
+    return;
+  }
+
+  for(unsigned i = 0; i < sizeof usage; i++) {
+    if(!put_user(buffer + i, ((uint8_t *) &usage)[i])) {
+      error_exit(f);
+    }
+  }
+  SET_RETURN_VALUE(true);
+}
+
+/* Apply advice on how a range of user memory will be used */
+static void
+madvise(const void *args, struct intr_frame *f) {
+  uint8_t *addr;
+  int length, advice;
+
+  if(!get_arg_ptr(args, 0, &addr) || !get_arg_int(args, 1, &length)
+     || !get_arg_int(args, 2, &advice)) {
+    error_exit(f);
+  }
+
+#ifdef VM
+  SET_RETURN_VALUE(page_advise(addr, (unsigned) length, advice));
+#else
+  /* Without demand paging there is nothing to act on. */
+  SET_RETURN_VALUE(false);
+#endif
+}
+
+/* Move the end of the heap, returning where it ends up */
+static void
+brk(const void *args, struct intr_frame *f) {
+  uint8_t *end;
+
+  if(!get_arg_ptr(args, 0, &end)) {
+    error_exit(f);
+  }
+
+  SET_RETURN_VALUE((uint32_t) process_set_break(end));
+}
+
+/* Give up the CPU to any other thread that is ready to run */
+static void
+yield(void) {
+  thread_yield();
+}
@@ -0,0 +1,126 @@
+#include "vm/evict.h"
+#include <debug.h>
+#include <list.h>
+#include "vm/frame.h"
+
+/* Simplified 2Q.
+
+   New frames enter A1, a FIFO queue.  A frame referenced again
+   while in A1, beyond the access that brought it in, is promoted
+   to Am, which is managed by second chance.  Victims come from A1
+   while it holds more than 1/A1_SHARE of all frames, so that a
+   single sequential sweep over memory cannot flush the frames in
+   real use.  The full algorithm's A1out queue of recently evicted
+   pages is left out: it would need page identities that outlive
+   their frames. */
+
+/* Queues. */
+enum
+  {
+    QUEUE_A1,                   /* Referenced once. */
+    QUEUE_AM                    /* Referenced repeatedly. */
+  };
+
+/* A1 is kept to at most 1/A1_SHARE of the frames. */
+#define A1_SHARE 4
+
+static struct list a1, am;
+static size_t a1_cnt, am_cnt;
+
+static void
+twoq_init (void)
+{
+  list_init (&a1);
+  list_init (&am);
+}
+
+static void
+twoq_on_map (struct frame *f)
+{
+  f->queue = QUEUE_A1;
+  f->age = 0;
+  list_push_back (&a1, &f->policy_elem);
+  a1_cnt++;
+}
+
+static void
+twoq_on_unmap (struct frame *f)
+{
+  list_remove (&f->policy_elem);
+  if (f->queue == QUEUE_A1)
+    a1_cnt--;
+  else
+    am_cnt--;
+}
+
+/* Scans A1 in FIFO order, promoting re-referenced frames to Am,
+   and returns the first unpinned, unreferenced frame, if any.
+   The age member counts the references seen. */
+static struct frame *
+scan_a1 (void)
+{
+  struct list_elem *e, *next;
+
+  for (e = list_begin (&a1); e != list_end (&a1); e = next)
+    {
+      struct frame *f = list_entry (e, struct frame, policy_elem);
+
+      next = list_next (e);
+      if (f->pin_cnt > 0)
+        continue;
+      if (!frame_test_accessed (f, true))
+        return f;
+      if (f->age++ > 0)
+        {
+          list_remove (e);
+          a1_cnt--;
+          f->queue = QUEUE_AM;
+          list_push_back (&am, e);
+          am_cnt++;
+        }
+    }
+  return NULL;
+}
+
+/* Runs second chance over Am. */
+static struct frame *
+scan_am (void)
+{
+  size_t i;
+
+  for (i = 0; i < 2 * am_cnt + 1 && !list_empty (&am); i++)
+    {
+      struct list_elem *e = list_front (&am);
+      struct frame *f = list_entry (e, struct frame, policy_elem);
+
+      if (f->pin_cnt == 0 && !frame_test_accessed (f, true))
+        return f;
+      list_remove (e);
+      list_push_back (&am, e);
+    }
+  return NULL;
+}
+
+static struct frame *
+twoq_pick_victim (void)
+{
+  struct frame *f = NULL;
+
+  if (a1_cnt * A1_SHARE > a1_cnt + am_cnt)
+    f = scan_a1 ();
+  if (f == NULL)
+    f = scan_am ();
+  if (f == NULL)
+    f = scan_a1 ();
+  return f;
+}
+
+const struct evict_policy evict_2q =
+  {
+    "2q",
+    twoq_init,
+    twoq_on_map,
+    twoq_on_unmap,
+    NULL,
+    twoq_pick_victim,
+  };
@@ -0,0 +1,120 @@
+#include "vm/evict.h"
+#include <debug.h>
+#include <list.h>
+#include "vm/frame.h"
+
+/* Clock (second chance) and enhanced clock.
+
+   Frames sit on a circular list swept by a hand.  Plain clock
+   evicts the first unpinned frame whose accessed bit is clear,
+   clearing set bits as the hand passes.  Enhanced clock also
+   weighs the dirty bit, preferring in order: not accessed and
+   clean, not accessed but dirty, and so on, since a clean frame
+   can be dropped without a swap write. */
+
+/* Frames, in the order the hand visits them. */
+static struct list frames;
+static size_t frame_cnt;
+
+/* Next frame the hand will look at, or the list's end. */
+static struct list_elem *hand;
+
+static void
+clock_init (void)
+{
+  list_init (&frames);
+  hand = list_end (&frames);
+}
+
+/* Inserts F just behind the hand, making it the last frame the
+   hand reaches. */
+static void
+clock_on_map (struct frame *f)
+{
+  list_insert (hand, &f->policy_elem);
+  frame_cnt++;
+}
+
+static void
+clock_on_unmap (struct frame *f)
+{
+  if (hand == &f->policy_elem)
+    hand = list_next (hand);
+  list_remove (&f->policy_elem);
+  frame_cnt--;
+}
+
+/* Returns the frame under the hand and advances the hand. */
+static struct frame *
+clock_advance (void)
+{
+  struct frame *f;
+
+  ASSERT (frame_cnt > 0);
+
+  if (hand == list_end (&frames))
+    hand = list_begin (&frames);
+  f = list_entry (hand, struct frame, policy_elem);
+  hand = list_next (hand);
+  return f;
+}
+
+static struct frame *
+clock_pick_victim (void)
+{
+  size_t i;
+
+  /* One sweep clears the accessed bit of every unpinned frame,
+     so the second finds a victim unless every frame is pinned. */
+  for (i = 0; i < 2 * frame_cnt; i++)
+    {
+      struct frame *f = clock_advance ();
+      if (f->pin_cnt == 0 && !frame_test_accessed (f, true))
+        return f;
+    }
+  return NULL;
+}
+
+static struct frame *
+eclock_pick_victim (void)
+{
+  int pass;
+  size_t i;
+
+  /* Odd passes look for dirty frames and clear accessed bits,
+     so after pass 1 nothing is accessed any more. */
+  for (pass = 0; pass < 4; pass++)
+    {
+      bool want_dirty = pass % 2 == 1;
+
+      for (i = 0; i < frame_cnt; i++)
+        {
+          struct frame *f = clock_advance ();
+          if (f->pin_cnt == 0
+              && !frame_test_accessed (f, want_dirty)
+              && frame_is_dirty (f) == want_dirty)
+            return f;
+        }
+    }
+  return NULL;
+}
+
+const struct evict_policy evict_clock =
+  {
+    "clock",
+    clock_init,
+    clock_on_map,
+    clock_on_unmap,
+    NULL,
+    clock_pick_victim,
+  };
+
+const struct evict_policy evict_eclock =
+  {
+    "eclock",
+    clock_init,
+    clock_on_map,
+    clock_on_unmap,
+    NULL,
+    eclock_pick_victim,
+  };
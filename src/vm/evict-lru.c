@@ -0,0 +1,103 @@
+#include "vm/evict.h"
+#include <debug.h>
+#include <limits.h>
+#include <list.h>
+#include "devices/timer.h"
+#include "threads/thread.h"
+#include "vm/frame.h"
+
+/* Approximate LRU by aging.
+
+   A kernel thread samples every frame's accessed bit each
+   AGING_INTERVAL, shifting it into the top of the frame's 8-bit
+   age, so that the age holds the frame's reference history over
+   the last eight intervals.  The victim is the unpinned frame
+   with the smallest age, passing over frames referenced since
+   the last sample. */
+
+/* Timer ticks between samples. */
+#define AGING_INTERVAL (TIMER_FREQ / 10)
+
+/* All frames, oldest allocation first. */
+static struct list frames;
+
+static thread_func aging_thread NO_RETURN;
+
+static void
+lru_init (void)
+{
+  list_init (&frames);
+  thread_create ("vm-aging", PRI_DEFAULT, aging_thread, NULL);
+}
+
+/* A new frame counts as just referenced. */
+static void
+lru_on_map (struct frame *f)
+{
+  f->age = 0x80;
+  list_push_back (&frames, &f->policy_elem);
+}
+
+static void
+lru_on_unmap (struct frame *f)
+{
+  list_remove (&f->policy_elem);
+}
+
+static void
+lru_on_access_scan (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&frames); e != list_end (&frames); e = list_next (e))
+    {
+      struct frame *f = list_entry (e, struct frame, policy_elem);
+      f->age = (f->age >> 1) | (frame_test_accessed (f, true) ? 0x80 : 0);
+    }
+}
+
+static struct frame *
+lru_pick_victim (void)
+{
+  struct frame *victim = NULL;
+  unsigned victim_age = UINT_MAX;
+  struct list_elem *e;
+
+  for (e = list_begin (&frames); e != list_end (&frames); e = list_next (e))
+    {
+      struct frame *f = list_entry (e, struct frame, policy_elem);
+      unsigned age = f->age;
+
+      if (f->pin_cnt > 0)
+        continue;
+      if (frame_test_accessed (f, false))
+        age |= 0x100;
+      if (age < victim_age)
+        {
+          victim = f;
+          victim_age = age;
+        }
+    }
+  return victim;
+}
+
+/* Samples accessed bits every AGING_INTERVAL. */
+static void
+aging_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (AGING_INTERVAL);
+      frame_scan ();
+    }
+}
+
+const struct evict_policy evict_lru =
+  {
+    "lru",
+    lru_init,
+    lru_on_map,
+    lru_on_unmap,
+    lru_on_access_scan,
+    lru_pick_victim,
+  };
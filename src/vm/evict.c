@@ -0,0 +1,42 @@
+#include "vm/evict.h"
+#include <string.h>
+
+/* Available policies. */
+static const struct evict_policy *const policies[] =
+  {
+    &evict_clock,
+    &evict_eclock,
+    &evict_lru,
+    &evict_2q,
+  };
+
+#define POLICY_CNT (sizeof policies / sizeof *policies)
+
+/* The selected policy, clock by default.
+   Controlled by kernel command-line option "-evict". */
+const struct evict_policy *evict_policy = &evict_clock;
+
+/* Selects the policy called NAME.  Returns false if there is no
+   such policy. */
+bool
+evict_select (const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < POLICY_CNT; i++)
+    if (!strcmp (policies[i]->name, name))
+      {
+        evict_policy = policies[i];
+        return true;
+      }
+  return false;
+}
+
+/* Initializes the selected policy.  Must be called after the
+   thread system and timer are running, before any user frame is
+   allocated. */
+void
+evict_init (void)
+{
+  evict_policy->init ();
+}
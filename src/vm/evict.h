@@ -0,0 +1,50 @@
+#ifndef VM_EVICT_H
+#define VM_EVICT_H
+
+#include <stdbool.h>
+
+struct frame;
+
+/* A page replacement policy.
+
+   The frame table calls into the selected policy, always with
+   its lock held, whenever a frame enters or leaves memory and
+   when it needs a frame to evict.  A policy keeps whatever
+   structure it likes over the frames, through the policy_elem,
+   age and queue members of struct frame, and judges recency with
+   frame_test_accessed() and frame_is_dirty(). */
+struct evict_policy
+  {
+    const char *name;                   /* Name for "-evict=". */
+
+    /* Initializes the policy and starts any helper threads. */
+    void (*init) (void);
+
+    /* Frame F was allocated, and is about to be mapped. */
+    void (*on_map) (struct frame *f);
+
+    /* Frame F is being freed or evicted. */
+    void (*on_unmap) (struct frame *f);
+
+    /* Samples and clears the accessed bits of all frames.  Called
+       periodically if the policy starts a thread that does so
+       through frame_scan().  May be null. */
+    void (*on_access_scan) (void);
+
+    /* Returns an unpinned frame to evict, or a null pointer if
+       every frame is pinned. */
+    struct frame *(*pick_victim) (void);
+  };
+
+extern const struct evict_policy evict_clock;
+extern const struct evict_policy evict_eclock;
+extern const struct evict_policy evict_lru;
+extern const struct evict_policy evict_2q;
+
+/* The selected policy. */
+extern const struct evict_policy *evict_policy;
+
+bool evict_select (const char *name);
+void evict_init (void);
+
+#endif /* vm/evict.h */
@@ -0,0 +1,619 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/evict.h"
+#include "vm/merge.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+
+/* All user frames, keyed by kernel virtual address. */
+static struct hash frame_table;
+
+/* Shared read-only executable frames, keyed by file position. */
+static struct hash share_table;
+
+/* All user frames other than the zero frame, in allocation
+   order, and the next one for frame_visit() to visit. */
+static struct list frame_list;
+static struct list_elem *visit_cursor;
+
+/* Protects the tables, the frame list, every frame's pages and
+   pin count, the frame and type of every page, the replacement
+   policy and the merge table.
+   Eviction drops it across its swap write, with the frame pinned
+   and its pages already pointing to the swap slot.  A process
+   faulting one of them back in waits in swap_read() until the
+   slot is written. */
+static struct lock frame_lock;
+
+/* The zero frame, never freed. */
+static struct frame *zero_frame;
+
+/* Statistics. */
+static long long share_hits;    /* # of mappings served from the share table. */
+static long long share_misses;  /* # of shared pages read from disk. */
+static long long evictions;     /* # of frames evicted. */
+
+static hash_hash_func frame_hash, share_hash;
+static hash_less_func frame_less, share_less;
+static struct frame *frame_lookup (void *kpage);
+static struct frame *evict (void);
+static void free_frame (struct frame *);
+
+/* Initializes the frame table. */
+void
+frame_init (void)
+{
+  hash_init (&frame_table, frame_hash, frame_less, NULL);
+  hash_init (&share_table, share_hash, share_less, NULL);
+  list_init (&frame_list);
+  visit_cursor = list_end (&frame_list);
+  lock_init (&frame_lock);
+
+  /* The zero frame is pinned for good and never seen by the
+     replacement policy. */
+  zero_frame = malloc (sizeof *zero_frame);
+  if (zero_frame == NULL)
+    PANIC ("can't allocate the zero frame");
+  zero_frame->kpage = palloc_get_page (PAL_USER | PAL_ZERO | PAL_ASSERT);
+  list_init (&zero_frame->pages);
+  zero_frame->pin_cnt = 1;
+  zero_frame->shared = false;
+  zero_frame->merged = false;
+  hash_insert (&frame_table, &zero_frame->elem);
+}
+
+/* Obtains a frame from the user pool, with FLAGS as for
+   palloc_get_page(), evicting another frame if the pool is
+   exhausted.  The frame is returned pinned, with no pages: the
+   caller maps it with frame_map() and then drops its pin with
+   frame_unpin().  Returns its kernel virtual address, or a null
+   pointer if no frame can be freed up. */
+void *
+frame_alloc (enum palloc_flags flags)
+{
+  struct frame *f;
+  void *kpage;
+
+  kpage = palloc_get_page (PAL_USER | flags);
+
+  lock_acquire (&frame_lock);
+  if (kpage != NULL)
+    {
+      f = malloc (sizeof *f);
+      if (f == NULL)
+        {
+          lock_release (&frame_lock);
+          palloc_free_page (kpage);
+          return NULL;
+        }
+      f->kpage = kpage;
+      hash_insert (&frame_table, &f->elem);
+      list_push_back (&frame_list, &f->list_elem);
+    }
+  else
+    {
+      f = evict ();
+      if (f == NULL)
+        {
+          lock_release (&frame_lock);
+          return NULL;
+        }
+      if (flags & PAL_ZERO)
+        memset (f->kpage, 0, PGSIZE);
+    }
+  list_init (&f->pages);
+  f->pin_cnt = 1;
+  f->shared = false;
+  f->merged = false;
+  f->checksum = 0;
+  evict_policy->on_map (f);
+  lock_release (&frame_lock);
+  return f->kpage;
+}
+
+/* Returns a pinned frame holding the contents of read-only file
+   page P.  If another process already has that page of the same
+   file resident, its frame is returned; otherwise the page is
+   read from disk and entered into the share table, and *LOADED
+   is set to true.  Returns a null pointer if memory allocation or
+   the read fails. */
+void *
+frame_get_shared (struct page *p, bool *loaded)
+{
+  struct frame key, *f;
+  struct hash_elem *e;
+  uint8_t *kpage;
+
+  ASSERT (p->type == PAGE_FILE);
+  ASSERT (p->ofs % PGSIZE == 0);
+  ASSERT (p->read_bytes <= PGSIZE);
+
+  key.sector = inode_get_inumber (file_get_inode (p->file));
+  key.ofs = p->ofs;
+  key.read_bytes = p->read_bytes;
+  *loaded = false;
+
+  lock_acquire (&frame_lock);
+  e = hash_find (&share_table, &key.share_elem);
+  if (e != NULL)
+    {
+      f = hash_entry (e, struct frame, share_elem);
+      f->pin_cnt++;
+      share_hits++;
+      lock_release (&frame_lock);
+      return f->kpage;
+    }
+  lock_release (&frame_lock);
+
+  /* Not resident.  Read it without holding the lock, so that
+     the disk access does not stall other processes' frames. */
+  kpage = frame_alloc (0);
+  if (kpage == NULL)
+    return NULL;
+  if (read_file_at (p->file, kpage, p->read_bytes, p->ofs)
+      != (off_t) p->read_bytes)
+    {
+      frame_unpin (kpage);
+      return NULL;
+    }
+  memset (kpage + p->read_bytes, 0, PGSIZE - p->read_bytes);
+  *loaded = true;
+
+  lock_acquire (&frame_lock);
+  f = frame_lookup (kpage);
+  f->sector = key.sector;
+  f->ofs = key.ofs;
+  f->read_bytes = key.read_bytes;
+  e = hash_insert (&share_table, &f->share_elem);
+  if (e != NULL)
+    {
+      /* Another process read the same page meanwhile.  Use its
+         copy and drop ours. */
+      struct frame *winner = hash_entry (e, struct frame, share_elem);
+      winner->pin_cnt++;
+      share_hits++;
+      lock_release (&frame_lock);
+      frame_unpin (kpage);
+      return winner->kpage;
+    }
+  f->shared = true;
+  share_misses++;
+  lock_release (&frame_lock);
+  return kpage;
+}
+
+/* Returns the zero frame, pinned.  It must only be mapped
+   read-only. */
+void *
+frame_get_zero (void)
+{
+  lock_acquire (&frame_lock);
+  zero_frame->pin_cnt++;
+  lock_release (&frame_lock);
+  return zero_frame->kpage;
+}
+
+/* Returns true if KPAGE is the zero frame. */
+bool
+frame_is_zero (const void *kpage)
+{
+  return kpage == zero_frame->kpage;
+}
+
+/* Maps page P, which must not be resident, to the pinned frame
+   at KPAGE in its owner's page directory, read-only unless
+   WRITABLE.  Returns false if memory allocation fails. */
+bool
+frame_map (void *kpage, struct page *p, bool writable)
+{
+  struct frame *f;
+  bool success;
+
+  lock_acquire (&frame_lock);
+  f = frame_lookup (kpage);
+  ASSERT (f != NULL);
+  ASSERT (f->pin_cnt > 0);
+  ASSERT (p->frame == NULL);
+
+  success = pagedir_set_page (p->owner->pagedir, p->upage, kpage, writable);
+  if (success)
+    {
+      struct rusage *usage = &p->owner->rusage;
+
+      list_push_back (&f->pages, &p->frame_elem);
+      p->frame = f;
+      if (++usage->resident_pages > usage->max_resident_pages)
+        usage->max_resident_pages = usage->resident_pages;
+    }
+  lock_release (&frame_lock);
+  return success;
+}
+
+/* Unmaps page P from its frame, if it is resident, freeing the
+   frame if no other page maps or pins it.  The page's contents
+   are discarded. */
+void
+frame_unmap (struct page *p)
+{
+  struct frame *f;
+
+  lock_acquire (&frame_lock);
+  f = p->frame;
+  if (f != NULL)
+    {
+      pagedir_clear_page (p->owner->pagedir, p->upage);
+      list_remove (&p->frame_elem);
+      p->frame = NULL;
+      p->owner->rusage.resident_pages--;
+      if (list_empty (&f->pages) && f->pin_cnt == 0)
+        free_frame (f);
+    }
+  lock_release (&frame_lock);
+}
+
+/* Pins the frame of page P against eviction and returns its
+   kernel virtual address, or returns a null pointer if P is not
+   resident. */
+void *
+frame_pin (struct page *p)
+{
+  void *kpage = NULL;
+
+  lock_acquire (&frame_lock);
+  if (p->frame != NULL)
+    {
+      p->frame->pin_cnt++;
+      kpage = p->frame->kpage;
+    }
+  lock_release (&frame_lock);
+  return kpage;
+}
+
+/* Drops one pin of the frame at KPAGE, freeing the frame if no
+   page maps or pins it any more. */
+void
+frame_unpin (void *kpage)
+{
+  struct frame *f;
+
+  lock_acquire (&frame_lock);
+  f = frame_lookup (kpage);
+  ASSERT (f != NULL);
+  ASSERT (f->pin_cnt > 0);
+  if (--f->pin_cnt == 0 && list_empty (&f->pages))
+    free_frame (f);
+  lock_release (&frame_lock);
+}
+
+/* Marks the frame of page P, if it is resident, as not used
+   lately, so that the replacement policy picks it early. */
+void
+frame_deactivate (struct page *p)
+{
+  struct frame *f;
+
+  lock_acquire (&frame_lock);
+  f = p->frame;
+  if (f != NULL && f != zero_frame)
+    {
+      frame_test_accessed (f, true);
+      f->age = 0;
+    }
+  lock_release (&frame_lock);
+}
+
+/* Lets the replacement policy sample the accessed bits of all
+   frames. */
+void
+frame_scan (void)
+{
+  lock_acquire (&frame_lock);
+  if (evict_policy->on_access_scan != NULL)
+    evict_policy->on_access_scan ();
+  lock_release (&frame_lock);
+}
+
+/* Returns true if any page mapping F has been accessed since its
+   accessed bit was last cleared, and clears the bits if CLEAR. */
+bool
+frame_test_accessed (struct frame *f, bool clear)
+{
+  struct list_elem *e;
+  bool accessed = false;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    {
+      struct page *p = list_entry (e, struct page, frame_elem);
+      uint32_t *pd = p->owner->pagedir;
+
+      if (pagedir_is_accessed (pd, p->upage))
+        {
+          accessed = true;
+          if (clear)
+            pagedir_set_accessed (pd, p->upage, false);
+        }
+    }
+  return accessed;
+}
+
+/* Returns true if F must be written to swap to be evicted,
+   because a page mapping it was written or has no other copy. */
+bool
+frame_is_dirty (struct frame *f)
+{
+  struct list_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    {
+      struct page *p = list_entry (e, struct page, frame_elem);
+
+      if (p->type == PAGE_ANON || pagedir_is_dirty (p->owner->pagedir,
+                                                    p->upage))
+        return true;
+    }
+  return false;
+}
+
+/* Calls VISIT on each of the next CNT frames in the frame list
+   that are mapped and not pinned, wrapping around at its end.
+   Successive calls take up where the last one left off.  The
+   frame table is locked for each call to VISIT, but not in
+   between, so that a long walk does not stall page faults. */
+void
+frame_visit (size_t cnt, void (*visit) (struct frame *))
+{
+  for (; cnt > 0; cnt--)
+    {
+      struct frame *f;
+
+      lock_acquire (&frame_lock);
+      if (list_empty (&frame_list))
+        {
+          lock_release (&frame_lock);
+          return;
+        }
+      if (visit_cursor == list_end (&frame_list))
+        visit_cursor = list_begin (&frame_list);
+      f = list_entry (visit_cursor, struct frame, list_elem);
+      visit_cursor = list_next (visit_cursor);
+      if (f->pin_cnt == 0 && !list_empty (&f->pages))
+        visit (f);
+      lock_release (&frame_lock);
+    }
+}
+
+/* Makes every page mapping F read-only, copy-on-write if it is
+   writable, so that F's contents stay fixed until a page breaks
+   away with a private copy.  A page that was written becomes
+   anonymous, because remapping it loses its dirty bit.  The
+   caller must hold frame_lock. */
+void
+frame_write_protect (struct frame *f)
+{
+  struct list_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+  ASSERT (f != zero_frame);
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    {
+      struct page *p = list_entry (e, struct page, frame_elem);
+      uint32_t *pd = p->owner->pagedir;
+
+      if (pagedir_is_dirty (pd, p->upage))
+        p->type = PAGE_ANON;
+      if (p->writable)
+        pagedir_set_cow (pd, p->upage, true);
+    }
+}
+
+/* Remaps every page mapping F, which frame_write_protect() has
+   frozen, to INTO, a frozen frame with the same contents, or to
+   the zero frame if INTO is null, and frees F.  The caller must
+   hold frame_lock. */
+void
+frame_merge_into (struct frame *f, struct frame *into)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+  ASSERT (f != zero_frame && f != into);
+  ASSERT (f->pin_cnt == 0);
+
+  if (into == NULL)
+    into = zero_frame;
+  while (!list_empty (&f->pages))
+    {
+      struct page *p = list_entry (list_pop_front (&f->pages),
+                                   struct page, frame_elem);
+      uint32_t *pd = p->owner->pagedir;
+
+      /* The page table is already there, so remapping cannot
+         fail. */
+      pagedir_clear_page (pd, p->upage);
+      if (!pagedir_set_page (pd, p->upage, into->kpage, false))
+        NOT_REACHED ();
+      if (p->writable)
+        pagedir_set_cow (pd, p->upage, true);
+      if (into == zero_frame)
+        p->type = PAGE_ZERO;
+      list_push_back (&into->pages, &p->frame_elem);
+      p->frame = into;
+    }
+  free_frame (f);
+}
+
+/* Prints frame statistics. */
+void
+frame_print_stats (void)
+{
+  printf ("Frames: %zu in use, %zu shared, %lld share hits, "
+          "%lld share misses, %zu zero mappings\n",
+          hash_size (&frame_table), hash_size (&share_table),
+          share_hits, share_misses, list_size (&zero_frame->pages));
+  printf ("Evict: %s policy, %lld evictions\n",
+          evict_policy->name, evictions);
+}
+
+/* Evicts the frame chosen by the replacement policy and returns
+   it, still in the frame table but with no pages and out of the
+   policy's hands.  Returns a null pointer if every frame is
+   pinned or swap is full.
+
+   Every page mapping the frame is unmapped and updated before
+   anything can block, so that a process that faults on one of
+   them afterward sees where its contents went.  If the frame
+   must be written out, all of them share its swap slot, which
+   is written with frame_lock released and the frame pinned. */
+static struct frame *
+evict (void)
+{
+  struct frame *f;
+  size_t slot = SWAP_NONE;
+  bool dirty;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  f = evict_policy->pick_victim ();
+  if (f == NULL)
+    return NULL;
+  ASSERT (f->pin_cnt == 0);
+  ASSERT (!list_empty (&f->pages));
+
+  dirty = frame_is_dirty (f);
+  if (dirty)
+    {
+      slot = swap_alloc ();
+      if (slot == SWAP_NONE)
+        return NULL;
+    }
+
+  while (!list_empty (&f->pages))
+    {
+      struct page *p = list_entry (list_pop_front (&f->pages),
+                                   struct page, frame_elem);
+
+      pagedir_clear_page (p->owner->pagedir, p->upage);
+      p->frame = NULL;
+      p->owner->rusage.resident_pages--;
+      if (dirty)
+        {
+          p->type = PAGE_SWAP;
+          p->swap_slot = slot;
+          p->owner->rusage.swap_outs++;
+          swap_dup (slot);
+        }
+    }
+  if (f->shared)
+    {
+      hash_delete (&share_table, &f->share_elem);
+      f->shared = false;
+    }
+  if (f->merged)
+    merge_forget (f);
+  evict_policy->on_unmap (f);
+  evictions++;
+
+  /* Our own use of the slot keeps it from being freed and reused
+     while it is written, even if every page drops it. */
+  if (dirty)
+    {
+      f->pin_cnt = 1;
+      lock_release (&frame_lock);
+      swap_write (slot, f->kpage);
+      swap_free (slot);
+      lock_acquire (&frame_lock);
+    }
+  return f;
+}
+
+/* Frees F, which has no pages or pins.  The caller must hold
+   frame_lock. */
+static void
+free_frame (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+  ASSERT (f != zero_frame);
+
+  hash_delete (&frame_table, &f->elem);
+  if (visit_cursor == &f->list_elem)
+    visit_cursor = list_next (visit_cursor);
+  list_remove (&f->list_elem);
+  if (f->shared)
+    hash_delete (&share_table, &f->share_elem);
+  if (f->merged)
+    merge_forget (f);
+  evict_policy->on_unmap (f);
+  palloc_free_page (f->kpage);
+  free (f);
+}
+
+/* Returns the frame for KPAGE, or a null pointer if KPAGE is not
+   a user frame.  The caller must hold frame_lock. */
+static struct frame *
+frame_lookup (void *kpage)
+{
+  struct frame key;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  key.kpage = kpage;
+  e = hash_find (&frame_table, &key.elem);
+  return e != NULL ? hash_entry (e, struct frame, elem) : NULL;
+}
+
+/* Returns a hash value for frame E, by kernel address. */
+static unsigned
+frame_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame *f = hash_entry (e, struct frame, elem);
+  return hash_bytes (&f->kpage, sizeof f->kpage);
+}
+
+/* Returns true if frame A precedes frame B. */
+static bool
+frame_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct frame *a = hash_entry (a_, struct frame, elem);
+  const struct frame *b = hash_entry (b_, struct frame, elem);
+  return a->kpage < b->kpage;
+}
+
+/* Returns a hash value for shared frame E, by file position. */
+static unsigned
+share_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame *f = hash_entry (e, struct frame, share_elem);
+  return hash_int (f->sector) ^ hash_int (f->ofs) ^ f->read_bytes;
+}
+
+/* Returns true if shared frame A precedes shared frame B. */
+static bool
+share_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct frame *a = hash_entry (a_, struct frame, share_elem);
+  const struct frame *b = hash_entry (b_, struct frame, share_elem);
+  if (a->sector != b->sector)
+    return a->sector < b->sector;
+  if (a->ofs != b->ofs)
+    return a->ofs < b->ofs;
+  return a->read_bytes < b->read_bytes;
+}
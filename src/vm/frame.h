@@ -0,0 +1,85 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+#include "threads/palloc.h"
+
+struct page;
+
+/* A physical frame holding a page of user memory.
+
+   Every user frame is tracked here, keyed by its kernel virtual
+   address, together with the list of pages (see vm/page.h)
+   mapping it.  Read-only pages of executables are additionally
+   entered into a share table keyed by (inode sector, file
+   offset, bytes read), so that all processes running the same
+   executable map the same frame.  A frame is freed when it has
+   neither pages nor pins.
+
+   When memory runs out, the replacement policy (see vm/evict.h)
+   picks an unpinned frame, which is unmapped from all its pages
+   and written to swap if it holds data found nowhere else.
+
+   One permanent, all-zero frame is mapped read-only in place of
+   every page that would start out zeroed, until it is first
+   written.  It is never evicted.
+
+   The merge daemon (see vm/merge.h) also maps private pages with
+   identical contents to a single frame, copy-on-write.  Such a
+   frame may hold data found nowhere else for several pages at
+   once, so evicting it writes one swap slot that they share. */
+struct frame
+  {
+    struct hash_elem elem;              /* Element in the frame table. */
+    struct list_elem list_elem;         /* Element in the frame list. */
+    void *kpage;                        /* Kernel virtual address. */
+    struct list pages;                  /* Pages mapping this frame. */
+    int pin_cnt;                        /* Not evictable while nonzero. */
+
+    /* Owned by the replacement policy. */
+    struct list_elem policy_elem;       /* Element in the policy's lists. */
+    uint8_t age;                        /* Recency estimate. */
+    uint8_t queue;                      /* Queue the frame is in. */
+
+    /* Sharing of read-only executable pages. */
+    bool shared;                        /* In the share table? */
+    struct hash_elem share_elem;        /* Element in the share table. */
+    block_sector_t sector;              /* Inode sector of the executable. */
+    off_t ofs;                          /* Page-aligned offset in the file. */
+    size_t read_bytes;                  /* Bytes read, the rest is zeroed. */
+
+    /* Owned by the merge daemon. */
+    bool merged;                        /* In the merge table? */
+    struct hash_elem merge_elem;        /* Element in the merge table. */
+    unsigned checksum;                  /* Hash of contents at last visit. */
+  };
+
+void frame_init (void);
+void *frame_alloc (enum palloc_flags);
+void *frame_get_shared (struct page *, bool *loaded);
+void *frame_get_zero (void);
+bool frame_is_zero (const void *kpage);
+bool frame_map (void *kpage, struct page *, bool writable);
+void frame_unmap (struct page *);
+void *frame_pin (struct page *);
+void frame_unpin (void *kpage);
+void frame_deactivate (struct page *);
+void frame_scan (void);
+void frame_print_stats (void);
+
+/* For replacement policies, with the frame table locked. */
+bool frame_test_accessed (struct frame *, bool clear);
+bool frame_is_dirty (struct frame *);
+
+/* For the merge daemon. */
+void frame_visit (size_t cnt, void (*visit) (struct frame *));
+void frame_write_protect (struct frame *);
+void frame_merge_into (struct frame *, struct frame *into);
+
+#endif /* vm/frame.h */
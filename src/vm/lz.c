@@ -0,0 +1,141 @@
+#include "vm/lz.h"
+#include <debug.h>
+#include <string.h>
+#include "threads/vaddr.h"
+
+/* A small LZ77 compressor for pages, in the style of LZRW1.
+
+   The output is a sequence of groups, each a control byte
+   followed by eight items, one per control bit from least to
+   most significant.  A clear bit is a literal byte.  A set bit is
+   a two-byte back reference: 12 bits of distance (1...4095) and
+   4 bits of length.  Lengths 3...17 are stored as 0...14; 15
+   means a third byte follows, adding 18 to it, so that runs of up
+   to 273 bytes cost three bytes.  Matches are found through a
+   hash table of the last position each 3-byte string was seen
+   at, so compression is a single pass. */
+
+#define HASH_BITS 12
+#define MAX_DISTANCE 4095
+#define MIN_MATCH 3
+#define LONG_MATCH 18           /* Shortest match with a length byte. */
+#define MAX_MATCH (LONG_MATCH + 255)
+
+/* Returns the hash table index for the 3 bytes at P. */
+static inline unsigned
+hash3 (const uint8_t *p)
+{
+  unsigned x = p[0] | (p[1] << 8) | (p[2] << 16);
+  return (x * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Compresses the page at SRC into DST, using LZ_WORK_SIZE bytes
+   at WORK.  Returns the compressed length, or 0 if it would
+   exceed DST_CAP bytes. */
+size_t
+lz_compress (const void *src_, void *dst_, size_t dst_cap, void *work)
+{
+  const uint8_t *src = src_;
+  uint8_t *dst = dst_;
+  uint16_t *table = work;
+  size_t ip = 0, op = 0, ctrl = 0;
+  int bit = 8;
+
+  ASSERT (sizeof *table << HASH_BITS <= LZ_WORK_SIZE);
+  memset (table, 0, sizeof *table << HASH_BITS);
+
+  while (ip < PGSIZE)
+    {
+      size_t len = 0, dist = 0;
+
+      if (bit == 8)
+        {
+          if (op >= dst_cap)
+            return 0;
+          ctrl = op++;
+          dst[ctrl] = 0;
+          bit = 0;
+        }
+
+      if (ip + MIN_MATCH <= PGSIZE)
+        {
+          unsigned h = hash3 (src + ip);
+          size_t cand = table[h];
+
+          table[h] = ip;
+          if (cand < ip && ip - cand <= MAX_DISTANCE
+              && !memcmp (src + cand, src + ip, MIN_MATCH))
+            {
+              size_t max = PGSIZE - ip < MAX_MATCH ? PGSIZE - ip : MAX_MATCH;
+
+              dist = ip - cand;
+              len = MIN_MATCH;
+              while (len < max && src[cand + len] == src[ip + len])
+                len++;
+            }
+        }
+
+      if (len > 0)
+        {
+          if (op + (len >= LONG_MATCH ? 3 : 2) > dst_cap)
+            return 0;
+          dst[ctrl] |= 1 << bit;
+          dst[op++] = dist >> 4;
+          if (len < LONG_MATCH)
+            dst[op++] = (dist << 4) | (len - MIN_MATCH);
+          else
+            {
+              dst[op++] = (dist << 4) | 15;
+              dst[op++] = len - LONG_MATCH;
+            }
+          ip += len;
+        }
+      else
+        {
+          if (op >= dst_cap)
+            return 0;
+          dst[op++] = src[ip++];
+        }
+      bit++;
+    }
+  return op;
+}
+
+/* Decompresses the SRC_LEN bytes at SRC, produced by
+   lz_compress(), into the page at DST. */
+void
+lz_decompress (const void *src_, size_t src_len, void *dst_)
+{
+  const uint8_t *src = src_;
+  uint8_t *dst = dst_;
+  size_t ip = 0, op = 0;
+  uint8_t ctrl = 0;
+  int bit = 8;
+
+  while (op < PGSIZE)
+    {
+      if (bit == 8)
+        {
+          ctrl = src[ip++];
+          bit = 0;
+        }
+      if (ctrl & (1 << bit))
+        {
+          size_t dist = (src[ip] << 4) | (src[ip + 1] >> 4);
+          size_t len = (src[ip + 1] & 15) + MIN_MATCH;
+
+          ip += 2;
+          if (len == LONG_MATCH)
+            len += src[ip++];
+          ASSERT (dist > 0 && dist <= op && op + len <= PGSIZE);
+
+          /* Byte by byte: the source may overlap the output. */
+          for (; len > 0; len--, op++)
+            dst[op] = dst[op - dist];
+        }
+      else
+        dst[op++] = src[ip++];
+      bit++;
+    }
+  ASSERT (ip == src_len);
+}
@@ -0,0 +1,13 @@
+#ifndef VM_LZ_H
+#define VM_LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bytes of scratch memory lz_compress() needs. */
+#define LZ_WORK_SIZE 8192
+
+size_t lz_compress (const void *src, void *dst, size_t dst_cap, void *work);
+void lz_decompress (const void *src, size_t src_len, void *dst);
+
+#endif /* vm/lz.h */
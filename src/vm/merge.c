@@ -0,0 +1,180 @@
+#include "vm/merge.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+
+/* Same-page merging.
+
+   A kernel thread at the lowest priority wakes every
+   MERGE_INTERVAL and visits the next merge_batch user frames.  A
+   frame whose contents hash the same as at its previous visit is
+   taken to be stable: its pages are made copy-on-write, which
+   freezes the contents, and it is looked up in the merge table,
+   which holds frozen frames by contents.  If an identical frame
+   is there, every page of the visited frame is remapped to it
+   and the visited frame is freed; a frame of zeros is likewise
+   merged into the zero frame.  Otherwise the visited frame joins
+   the table itself.
+
+   A write to a merged page faults and gets a private copy, as
+   for any copy-on-write page.  A frame leaves the table when it
+   is freed or evicted.  The table is protected by the frame
+   table's lock, which is held whenever this module is called
+   from vm/frame.c. */
+
+/* Timer ticks between passes. */
+#define MERGE_INTERVAL (TIMER_FREQ / 5)
+
+/* Frames examined per pass. */
+size_t merge_batch = 32;
+
+/* Frozen frames, keyed by contents. */
+static struct hash merge_table;
+
+/* Statistics. */
+static long long merge_visits;  /* # of frames visited. */
+static long long merge_frames;  /* # of frames merged away. */
+static long long merge_zeros;   /* # of those merged into the zero frame. */
+
+static thread_func merge_thread NO_RETURN;
+static hash_hash_func merge_hash;
+static hash_less_func merge_less;
+static void merge_frame (struct frame *);
+
+/* Starts the merge daemon, unless merge_batch is 0. */
+void
+merge_init (void)
+{
+  hash_init (&merge_table, merge_hash, merge_less, NULL);
+  if (merge_batch > 0)
+    thread_create ("vm-merge", PRI_MIN, merge_thread, NULL);
+}
+
+/* Removes frame F, which is being freed or evicted, from the
+   merge table. */
+void
+merge_forget (struct frame *f)
+{
+  ASSERT (f->merged);
+
+  hash_delete (&merge_table, &f->merge_elem);
+  f->merged = false;
+}
+
+/* Prints merging statistics. */
+void
+merge_print_stats (void)
+{
+  struct hash_iterator i;
+  size_t saved = 0;
+
+  if (merge_batch == 0)
+    return;
+
+  /* Each frame in the table stands in for all but one of the
+     frames its pages would otherwise need. */
+  hash_first (&i, &merge_table);
+  while (hash_next (&i))
+    {
+      struct frame *f = hash_entry (hash_cur (&i), struct frame, merge_elem);
+      saved += list_size (&f->pages) - 1;
+    }
+  printf ("Merge: %lld frames visited, %lld merged (%lld zero), "
+          "%zu frozen, %zu pages saved now\n",
+          merge_visits, merge_frames, merge_zeros,
+          hash_size (&merge_table), saved);
+}
+
+/* Merges merge_batch frames every MERGE_INTERVAL.  Running at
+   PRI_MIN, it only uses time that no other thread wants. */
+static void
+merge_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (MERGE_INTERVAL);
+      frame_visit (merge_batch, merge_frame);
+    }
+}
+
+/* Returns true if the page at KPAGE is all zeros. */
+static bool
+is_zero_page (const void *kpage)
+{
+  const uint32_t *words = kpage;
+  size_t i;
+
+  for (i = 0; i < PGSIZE / sizeof *words; i++)
+    if (words[i] != 0)
+      return false;
+  return true;
+}
+
+/* Visits frame F, which is mapped and not pinned, with the frame
+   table locked. */
+static void
+merge_frame (struct frame *f)
+{
+  unsigned checksum;
+  struct hash_elem *e;
+
+  merge_visits++;
+
+  /* Executable pages are already shared, and frozen frames have
+     nothing left to merge with. */
+  if (f->shared || f->merged)
+    return;
+
+  /* Leave frames that changed since the last visit alone: they
+     would likely only be copied again soon. */
+  checksum = hash_bytes (f->kpage, PGSIZE);
+  if (checksum != f->checksum)
+    {
+      f->checksum = checksum;
+      return;
+    }
+
+  /* Freeze the frame, then look at what it finally holds. */
+  frame_write_protect (f);
+  f->checksum = hash_bytes (f->kpage, PGSIZE);
+  if (is_zero_page (f->kpage))
+    {
+      frame_merge_into (f, NULL);
+      merge_frames++;
+      merge_zeros++;
+      return;
+    }
+
+  e = hash_insert (&merge_table, &f->merge_elem);
+  if (e != NULL)
+    {
+      frame_merge_into (f, hash_entry (e, struct frame, merge_elem));
+      merge_frames++;
+    }
+  else
+    f->merged = true;
+}
+
+/* Returns a hash value for frozen frame E, by contents. */
+static unsigned
+merge_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_entry (e, struct frame, merge_elem)->checksum;
+}
+
+/* Returns true if frozen frame A's contents precede frozen frame
+   B's. */
+static bool
+merge_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct frame *a = hash_entry (a_, struct frame, merge_elem);
+  const struct frame *b = hash_entry (b_, struct frame, merge_elem);
+  return memcmp (a->kpage, b->kpage, PGSIZE) < 0;
+}
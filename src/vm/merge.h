@@ -0,0 +1,16 @@
+#ifndef VM_MERGE_H
+#define VM_MERGE_H
+
+#include <stddef.h>
+
+struct frame;
+
+/* Frames examined per pass of the merge daemon.
+   Controlled by kernel command-line option "-merge". */
+extern size_t merge_batch;
+
+void merge_init (void);
+void merge_forget (struct frame *);
+void merge_print_stats (void);
+
+#endif /* vm/merge.h */
@@ -0,0 +1,611 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <madvise.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
+
+/* Maximum size of a user stack, in pages (8 MB by default). */
+size_t stack_page_limit = 2048;
+
+/* Largest distance below the stack pointer that a stack access
+   can fault at: PUSHA stores 32 bytes below %esp before updating
+   it. */
+#define STACK_SLOP 32
+
+/* Pages read ahead of a fault in a range advised
+   MADV_SEQUENTIAL, and how far behind the fault pages in such a
+   range are offered up for eviction. */
+#define READAHEAD_PAGES 16
+#define DROP_BEHIND_PAGES 2
+
+/* Processes with pages for vm-prefetch to read in, the lock and
+   condition that guard the queue, and the process whose page
+   vm-prefetch is reading in, if any, with a condition signaled
+   when it is done.  The queue lock is never held along with any
+   process's pages_lock, so that a process paging in under its
+   own lock does not hold up the others. */
+static struct list prefetch_queue;
+static struct lock prefetch_lock;
+static struct condition prefetch_cond;
+static struct thread *prefetch_target;
+static struct condition prefetch_done;
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func page_destroy;
+static struct page *page_create (void *upage, bool writable);
+static struct page *page_lookup (struct thread *, const void *upage);
+static bool page_in (struct page *, bool write, bool fault);
+static bool pin_page (void *upage, bool write);
+static void unpin_pages (uint8_t *first, uint8_t *end);
+static bool is_stack_access (const void *fault_addr, const void *esp);
+static bool break_cow (struct page *);
+static void prefetch (uint8_t *first, uint8_t *end);
+static void prefetch_cancel (void);
+static thread_func prefetch_thread NO_RETURN;
+
+/* Starts the prefetch thread. */
+void
+page_init (void)
+{
+  list_init (&prefetch_queue);
+  lock_init (&prefetch_lock);
+  cond_init (&prefetch_cond);
+  cond_init (&prefetch_done);
+  thread_create ("vm-prefetch", PRI_DEFAULT, prefetch_thread, NULL);
+}
+
+/* Initializes the running process's supplemental page table.
+   Returns false if memory allocation fails. */
+bool
+page_table_create (void)
+{
+  struct thread *t = thread_current ();
+
+  lock_init (&t->pages_lock);
+  t->prefetch_next = t->prefetch_end = NULL;
+  return hash_init (&t->pages, page_hash, page_less, NULL);
+}
+
+/* Releases every page of the running process, with its frame
+   and swap slot.  Must be called before the process's page
+   directory is destroyed. */
+void
+page_table_destroy (void)
+{
+  struct thread *t = thread_current ();
+
+  /* Once off the queue, vm-prefetch is done with our pages. */
+  prefetch_cancel ();
+  lock_acquire (&t->pages_lock);
+  hash_destroy (&t->pages, page_destroy);
+  lock_release (&t->pages_lock);
+}
+
+/* Adds page UPAGE to the running process, to be loaded on first
+   access with the READ_BYTES bytes at page-aligned offset OFS in
+   FILE followed by zeros.  Returns false if UPAGE is already
+   present or memory allocation fails. */
+bool
+page_add_file (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes, bool writable)
+{
+  struct lock *pages_lock = &thread_current ()->pages_lock;
+  struct page *p;
+
+  ASSERT (ofs % PGSIZE == 0);
+  ASSERT (read_bytes <= PGSIZE);
+
+  lock_acquire (pages_lock);
+  p = page_create (upage, writable);
+  if (p != NULL && read_bytes > 0)
+    {
+      p->type = PAGE_FILE;
+      p->file = file;
+      p->ofs = ofs;
+      p->read_bytes = read_bytes;
+    }
+  lock_release (pages_lock);
+  return p != NULL;
+}
+
+/* Adds zeroed page UPAGE to the running process.  Returns false
+   if UPAGE is already present or memory allocation fails. */
+bool
+page_add_zero (void *upage, bool writable)
+{
+  struct lock *pages_lock = &thread_current ()->pages_lock;
+  struct page *p;
+
+  lock_acquire (pages_lock);
+  p = page_create (upage, writable);
+  lock_release (pages_lock);
+  return p != NULL;
+}
+
+/* Removes page UPAGE, which must be present, from the running
+   process, releasing its frame and swap slot. */
+void
+page_remove (void *upage)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+
+  lock_acquire (&t->pages_lock);
+  p = page_lookup (t, upage);
+  ASSERT (p != NULL);
+  hash_delete (&t->pages, &p->elem);
+  page_destroy (&p->elem, NULL);
+  lock_release (&t->pages_lock);
+}
+
+/* Tries to resolve a page fault at user address FAULT_ADDR in the
+   running process, caused by a read or, if WRITE, a write to a
+   page that is either NOT_PRESENT or read-only.  ESP is the
+   process's user stack pointer.  Returns true if the faulting
+   access may be retried, false if it is a genuine access
+   violation. */
+bool
+page_handle_fault (void *fault_addr, bool not_present, bool write,
+                   void *esp)
+{
+  struct thread *t = thread_current ();
+  uint8_t *upage = pg_round_down (fault_addr);
+  struct page *p;
+  bool success;
+
+  ASSERT (is_user_vaddr (fault_addr));
+
+  if (t->pagedir == NULL)
+    return false;
+
+  lock_acquire (&t->pages_lock);
+  p = page_lookup (t, upage);
+  if (p == NULL && not_present && is_stack_access (fault_addr, esp))
+    {
+      /* Grow the stack. */
+      p = page_create (upage, true);
+    }
+
+  if (p == NULL)
+    success = false;
+  else if (!not_present)
+    success = write && pagedir_is_cow (t->pagedir, upage) && break_cow (p);
+  else if (write && !p->writable)
+    success = false;
+  else if (p->frame != NULL)
+    {
+      /* vm-prefetch paged it in while we waited for the lock. */
+      success = true;
+    }
+  else
+    success = page_in (p, write, true);
+  lock_release (&t->pages_lock);
+
+  if (success && not_present && p->advice == MADV_SEQUENTIAL)
+    {
+      struct page *behind;
+
+      prefetch (upage + PGSIZE, upage + (READAHEAD_PAGES + 1) * PGSIZE);
+      behind = page_lookup (t, upage - DROP_BEHIND_PAGES * PGSIZE);
+      if (behind != NULL && behind->advice == MADV_SEQUENTIAL)
+        frame_deactivate (behind);
+    }
+  return success;
+}
+
+/* Makes the SIZE bytes at user address UADDR resident, and pins
+   them until page_unpin_buffer(), so that the kernel can access
+   them while holding locks that loading a page needs.  If WRITE,
+   the buffer must be writable, and gets private frames.  Returns
+   false, with nothing pinned, if any part of the buffer is not
+   valid user memory. */
+bool
+page_pin_buffer (const void *uaddr, size_t size, bool write)
+{
+  uint8_t *first = pg_round_down (uaddr);
+  uint8_t *end = (uint8_t *) uaddr + size;
+  uint8_t *upage;
+
+  for (upage = first; upage < end; upage += PGSIZE)
+    if (!pin_page (upage, write))
+      {
+        unpin_pages (first, upage);
+        return false;
+      }
+  return true;
+}
+
+/* Unpins the SIZE bytes at UADDR, pinned by page_pin_buffer(). */
+void
+page_unpin_buffer (const void *uaddr, size_t size)
+{
+  unpin_pages (pg_round_down (uaddr), (uint8_t *) uaddr + size);
+}
+
+/* Makes UPAGE resident and pins its frame.  If WRITE, UPAGE must
+   be writable and gets a private frame.  Returns false if UPAGE
+   is not valid user memory. */
+static bool
+pin_page (void *upage, bool write)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+  bool success;
+
+  if (!is_user_vaddr (upage))
+    return false;
+
+  lock_acquire (&t->pages_lock);
+  p = page_lookup (t, upage);
+  if (p == NULL
+      && is_stack_access ((uint8_t *) upage + PGSIZE - 1, t->user_esp))
+    p = page_create (upage, true);
+  if (p == NULL || (write && !p->writable))
+    success = false;
+  else
+    for (;;)
+      {
+        void *kpage = frame_pin (p);
+        if (kpage != NULL)
+          {
+            success = true;
+            if (!write || !pagedir_is_cow (t->pagedir, upage))
+              break;
+            frame_unpin (kpage);
+            if (!break_cow (p))
+              {
+                success = false;
+                break;
+              }
+          }
+        else if (!page_in (p, write, true))
+          {
+            success = false;
+            break;
+          }
+      }
+  lock_release (&t->pages_lock);
+  return success;
+}
+
+/* Unpins the pages from FIRST up to END. */
+static void
+unpin_pages (uint8_t *first, uint8_t *end)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  uint8_t *upage;
+
+  for (upage = first; upage < end; upage += PGSIZE)
+    frame_unpin (pagedir_get_page (pd, upage));
+}
+
+/* Applies ADVICE, an MADV_* value, to the LENGTH bytes of the
+   running process's memory at page-aligned ADDR.  Returns false,
+   doing nothing, unless the advice is known and every page in the
+   range is valid user memory. */
+bool
+page_advise (void *addr, size_t length, int advice)
+{
+  struct thread *t = thread_current ();
+  uint8_t *first = addr;
+  uint8_t *end = first + length;
+  uint8_t *upage;
+
+  if (pg_ofs (addr) != 0 || end < first || !is_user_vaddr (end - 1)
+      || advice < MADV_NORMAL || advice > MADV_DONTNEED)
+    return false;
+  for (upage = first; upage < end; upage += PGSIZE)
+    if (page_lookup (t, upage) == NULL)
+      return false;
+
+  if (advice == MADV_WILLNEED)
+    {
+      prefetch (first, end);
+      return true;
+    }
+
+  lock_acquire (&t->pages_lock);
+  for (upage = first; upage < end; upage += PGSIZE)
+    {
+      struct page *p = page_lookup (t, upage);
+
+      if (advice != MADV_DONTNEED)
+        p->advice = advice;
+      else if (p->writable)
+        {
+          /* Discard the contents.  A page of the executable goes
+             back to the file, any other to zeros. */
+          frame_unmap (p);
+          if (p->type == PAGE_SWAP)
+            swap_free (p->swap_slot);
+          p->type = p->file != NULL ? PAGE_FILE : PAGE_ZERO;
+        }
+      else
+        frame_unmap (p);
+    }
+  lock_release (&t->pages_lock);
+  return true;
+}
+
+/* Brings non-resident page P into memory for a read or, if
+   WRITE, a write.  If FAULT, counts a page fault, major if that
+   took a disk read.  Returns false if out of memory or the read
+   fails.  The caller must hold P's owner's pages_lock. */
+static bool
+page_in (struct page *p, bool write, bool fault)
+{
+  uint32_t *pd = p->owner->pagedir;
+  struct rusage *usage = &p->owner->rusage;
+  bool writable = p->writable;
+  bool major = false;
+  bool success;
+  void *kpage;
+
+  if (p->type == PAGE_ZERO && !write)
+    {
+      /* Share the zero frame until the page is written. */
+      kpage = frame_get_zero ();
+      writable = false;
+    }
+  else if (p->type == PAGE_FILE && !p->writable)
+    {
+      kpage = frame_get_shared (p, &major);
+      if (major)
+        usage->paging_bytes += p->read_bytes;
+    }
+  else
+    {
+      kpage = frame_alloc (p->type == PAGE_ZERO ? PAL_ZERO : 0);
+      if (kpage == NULL)
+        return false;
+      if (p->type == PAGE_FILE)
+        {
+          if (read_file_at (p->file, kpage, p->read_bytes, p->ofs)
+              != (off_t) p->read_bytes)
+            {
+              frame_unpin (kpage);
+              return false;
+            }
+          memset ((uint8_t *) kpage + p->read_bytes, 0,
+                  PGSIZE - p->read_bytes);
+          major = true;
+          usage->paging_bytes += p->read_bytes;
+        }
+      else if (p->type == PAGE_SWAP)
+        {
+          /* Waits if an eviction is still writing the slot. */
+          major = swap_read (p->swap_slot, kpage);
+          if (major)
+            usage->paging_bytes += PGSIZE;
+          swap_free (p->swap_slot);
+          p->type = PAGE_ANON;
+        }
+    }
+  if (kpage == NULL)
+    return false;
+
+  success = frame_map (kpage, p, writable);
+  if (success)
+    {
+      if (frame_is_zero (kpage) && p->writable)
+        pagedir_set_cow (pd, p->upage, true);
+      if (!fault)
+        ;
+      else if (major)
+        usage->major_faults++;
+      else
+        usage->minor_faults++;
+    }
+  frame_unpin (kpage);
+  return success;
+}
+
+/* Returns true if a fault at FAULT_ADDR, with the user stack
+   pointer at ESP, looks like an access to the stack: it must lie
+   within the stack size limit and no further below ESP than a
+   push instruction reaches. */
+static bool
+is_stack_access (const void *fault_addr, const void *esp)
+{
+  const uint8_t *addr = fault_addr;
+  const uint8_t *stack_bottom = (uint8_t *) PHYS_BASE
+                                - stack_page_limit * PGSIZE;
+
+  return (esp != NULL
+          && addr >= stack_bottom
+          && addr + STACK_SLOP >= (const uint8_t *) esp);
+}
+
+/* Gives copy-on-write page P a private, writable copy of the
+   frame it shares.  Returns false if out of memory. */
+static bool
+break_cow (struct page *p)
+{
+  void *old_kpage, *new_kpage;
+  bool success = false;
+
+  /* Keep the old frame from being evicted while it is copied. */
+  old_kpage = frame_pin (p);
+  if (old_kpage == NULL)
+    return false;
+
+  /* A copy of the zero frame needs no copying. */
+  if (frame_is_zero (old_kpage))
+    new_kpage = frame_alloc (PAL_ZERO);
+  else
+    {
+      new_kpage = frame_alloc (0);
+      if (new_kpage != NULL)
+        memcpy (new_kpage, old_kpage, PGSIZE);
+    }
+  if (new_kpage != NULL)
+    {
+      frame_unmap (p);
+      success = frame_map (new_kpage, p, true);
+      if (success)
+        p->owner->rusage.minor_faults++;
+      frame_unpin (new_kpage);
+    }
+  frame_unpin (old_kpage);
+  return success;
+}
+
+/* Creates page UPAGE of the running process, initially zeroed,
+   and adds it to the supplemental page table.  Returns the page,
+   or a null pointer if UPAGE is already present or memory
+   allocation fails. */
+static struct page *
+page_create (void *upage, bool writable)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  p = malloc (sizeof *p);
+  if (p == NULL)
+    return NULL;
+  p->upage = upage;
+  p->owner = t;
+  p->writable = writable;
+  p->advice = MADV_NORMAL;
+  p->type = PAGE_ZERO;
+  p->frame = NULL;
+  p->file = NULL;
+  p->swap_slot = SWAP_NONE;
+  if (hash_insert (&t->pages, &p->elem) != NULL)
+    {
+      free (p);
+      return NULL;
+    }
+  return p;
+}
+
+/* Returns process T's page at UPAGE, or a null pointer if there
+   is none.  Only T changes its page table, and only while holding
+   its pages_lock, so any other thread must hold that lock. */
+static struct page *
+page_lookup (struct thread *t, const void *upage)
+{
+  struct page key;
+  struct hash_elem *e;
+
+  key.upage = (void *) upage;
+  e = hash_find (&t->pages, &key.elem);
+  return e != NULL ? hash_entry (e, struct page, elem) : NULL;
+}
+
+/* Queues the running process's pages from FIRST up to END for
+   vm-prefetch to read in, in place of any it had queued
+   before. */
+static void
+prefetch (uint8_t *first, uint8_t *end)
+{
+  struct thread *t = thread_current ();
+
+  if (first >= end)
+    return;
+  lock_acquire (&prefetch_lock);
+  if (t->prefetch_next >= t->prefetch_end)
+    list_push_back (&prefetch_queue, &t->prefetch_elem);
+  t->prefetch_next = first;
+  t->prefetch_end = end;
+  cond_signal (&prefetch_cond, &prefetch_lock);
+  lock_release (&prefetch_lock);
+}
+
+/* Takes the running process off the prefetch queue, and waits
+   for vm-prefetch to finish any page of it that it is reading
+   in. */
+static void
+prefetch_cancel (void)
+{
+  struct thread *t = thread_current ();
+
+  lock_acquire (&prefetch_lock);
+  if (t->prefetch_next < t->prefetch_end)
+    list_remove (&t->prefetch_elem);
+  t->prefetch_next = t->prefetch_end = NULL;
+  while (prefetch_target == t)
+    cond_wait (&prefetch_done, &prefetch_lock);
+  lock_release (&prefetch_lock);
+}
+
+/* Reads in queued pages one at a time, taking turns among the
+   processes in the queue.  Pages that are already resident or
+   would only be zeros are skipped. */
+static void
+prefetch_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct thread *t;
+      struct page *p;
+      uint8_t *upage;
+
+      lock_acquire (&prefetch_lock);
+      while (list_empty (&prefetch_queue))
+        cond_wait (&prefetch_cond, &prefetch_lock);
+      t = list_entry (list_pop_front (&prefetch_queue),
+                      struct thread, prefetch_elem);
+      upage = t->prefetch_next;
+      t->prefetch_next += PGSIZE;
+      if (t->prefetch_next < t->prefetch_end)
+        list_push_back (&prefetch_queue, &t->prefetch_elem);
+
+      /* T cannot exit while it is the target, because it must
+         first take itself off the queue, which waits for us. */
+      prefetch_target = t;
+      lock_release (&prefetch_lock);
+
+      lock_acquire (&t->pages_lock);
+      p = page_lookup (t, upage);
+      if (p != NULL && p->frame == NULL && p->type != PAGE_ZERO)
+        page_in (p, false, false);
+      lock_release (&t->pages_lock);
+
+      lock_acquire (&prefetch_lock);
+      prefetch_target = NULL;
+      cond_broadcast (&prefetch_done, &prefetch_lock);
+      lock_release (&prefetch_lock);
+    }
+}
+
+/* Releases page E's frame, swap slot, and memory. */
+static void
+page_destroy (struct hash_elem *e, void *aux UNUSED)
+{
+  struct page *p = hash_entry (e, struct page, elem);
+
+  frame_unmap (p);
+  if (p->type == PAGE_SWAP)
+    swap_free (p->swap_slot);
+  free (p);
+}
+
+/* Returns a hash value for page E, by user address. */
+static unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (e, struct page, elem);
+  return hash_bytes (&p->upage, sizeof p->upage);
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct page *a = hash_entry (a_, struct page, elem);
+  const struct page *b = hash_entry (b_, struct page, elem);
+  return a->upage < b->upage;
+}
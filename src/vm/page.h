@@ -0,0 +1,75 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+/* Where the contents of a page come from when it is not
+   resident. */
+enum page_type
+  {
+    PAGE_ZERO,                  /* All zeros. */
+    PAGE_FILE,                  /* Bytes of a file, then zeros. */
+    PAGE_SWAP,                  /* A swap slot. */
+    PAGE_ANON                   /* Nowhere: resident, must be swapped. */
+  };
+
+/* A page of a process's virtual address space.
+
+   Every process keeps its pages in a hash table, its
+   supplemental page table, which says how to bring in a page
+   that faults.  Pages of the executable and zeroed pages are
+   only read in or allocated on first access.  A clean page is
+   simply dropped on eviction, to be reloaded from where it came
+   from; a written page goes to swap, and becomes PAGE_ANON once
+   read back.
+
+   A process may also advise on how it will use its pages, with
+   the madvise() system call.  Pages it will need soon are read
+   in ahead of time by a kernel thread, vm-prefetch, which takes
+   the process's pages_lock to page them in; the process takes it
+   too when it changes its page table or pages in, so that the
+   two never bring in the same page at once. */
+struct page
+  {
+    struct hash_elem elem;      /* Element in owner's page table. */
+    void *upage;                /* User virtual address. */
+    struct thread *owner;       /* Owning process. */
+    bool writable;              /* Writable by the process? */
+    int advice;                 /* MADV_* value for this page. */
+
+    /* Protected by the frame table's lock. */
+    enum page_type type;        /* Where to find the contents. */
+    struct frame *frame;        /* Resident frame, or null. */
+    struct list_elem frame_elem; /* Element in frame's pages. */
+
+    /* PAGE_FILE. */
+    struct file *file;          /* File to read. */
+    off_t ofs;                  /* Page-aligned offset in FILE. */
+    size_t read_bytes;          /* Bytes to read, the rest is zeroed. */
+
+    /* PAGE_SWAP. */
+    size_t swap_slot;           /* Swap slot. */
+  };
+
+/* Maximum size of a user stack, in pages.
+   Controlled by kernel command-line option "-sl". */
+extern size_t stack_page_limit;
+
+void page_init (void);
+bool page_table_create (void);
+void page_table_destroy (void);
+bool page_add_file (void *upage, struct file *, off_t ofs,
+                    size_t read_bytes, bool writable);
+bool page_add_zero (void *upage, bool writable);
+void page_remove (void *upage);
+bool page_handle_fault (void *fault_addr, bool not_present, bool write,
+                        void *esp);
+bool page_pin_buffer (const void *uaddr, size_t size, bool write);
+void page_unpin_buffer (const void *uaddr, size_t size);
+bool page_advise (void *addr, size_t length, int advice);
+
+#endif /* vm/page.h */
@@ -0,0 +1,435 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/lz.h"
+
+/* Swap is kept in two tiers.
+
+   Every swapped page owns a slot on the swap device, reserved by
+   swap_alloc().  When it is written out, the page is first
+   compressed into a fixed pool of kernel memory instead; only
+   when the pool is full are the pages that have sat in it the
+   longest decompressed and written to their slots on disk.  A
+   page of zeros takes no pool space at all, so it is never
+   written out, and a page that does not compress well goes
+   straight to disk. */
+
+/* Number of sectors per page-sized swap slot. */
+#define SECTORS_PER_SLOT (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Size of an allocation unit of the compressed pool. */
+#define ZBLOCK_SIZE 64
+
+/* Largest compressed size worth keeping in memory. */
+#define ZMAX_LEN (PGSIZE * 3 / 4)
+
+/* Size of the compressed pool, in pages.
+   Controlled by kernel command-line option "-zswap". */
+size_t zswap_pages = 64;
+
+/* A page held compressed in the pool. */
+struct zpage
+  {
+    struct list_elem elem;      /* Element in zpage_list. */
+    size_t slot;                /* Swap slot reserved for it. */
+    size_t block;               /* First pool block. */
+    size_t len;                 /* Compressed bytes, 0 for zeros. */
+  };
+
+/* The swap device, or a null pointer if there is none. */
+static struct block *swap_device;
+
+/* Slots in use, one bit per slot, and the number of pages
+   sharing each slot. */
+static struct bitmap *used_slots;
+static unsigned *slot_refs;
+
+/* Slots reserved but not yet written, or being spilled from the
+   pool to disk, and a condition signaled whenever one is
+   written. */
+static struct bitmap *writing_slots;
+static struct condition slot_written;
+
+/* Compressed pool: ZBLOCK_SIZE-byte blocks and their allocation
+   bitmap, the pages in it indexed by slot, and a list of them
+   from oldest to newest. */
+static uint8_t *zpool;
+static struct bitmap *zpool_used;
+static struct zpage **zpages;
+static struct list zpage_list;
+
+/* Scratch memory for compressing and for spilling to disk.
+   SPILL_PAGE is in use while SPILL_BUSY. */
+static uint8_t *zbuf;
+static uint8_t *spill_page;
+static bool spill_busy;
+static void *lz_work;
+
+/* Protects all of the above. */
+static struct lock swap_lock;
+
+/* Statistics. */
+static long long swap_reads;    /* # of pages read from disk. */
+static long long swap_writes;   /* # of pages written to disk. */
+static long long zswap_stores;  /* # of pages stored in the pool. */
+static long long zswap_zeros;   /* # of those that were all zeros. */
+static long long zswap_rejects; /* # of pages too big compressed. */
+static long long zswap_spills;  /* # of pages moved to disk. */
+static long long zswap_loads;   /* # of pages read from the pool. */
+static long long stored_bytes;  /* Compressed size of pages stored. */
+static uint64_t ram_cycles;     /* Time reading from the pool. */
+static uint64_t disk_cycles;    /* Time reading from disk. */
+
+static void zswap_init (void);
+static bool zswap_store (size_t slot, const void *kpage);
+static void zswap_drop (struct zpage *);
+static bool zswap_spill (void);
+static void put_slot (size_t slot);
+static void disk_write (size_t slot, const void *kpage);
+static void disk_read (size_t slot, void *kpage);
+
+/* Initializes the swap area.  Without a swap device, pages that
+   must be written out cannot be evicted. */
+void
+swap_init (void)
+{
+  size_t slot_cnt = 0;
+
+  lock_init (&swap_lock);
+  cond_init (&slot_written);
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device != NULL)
+    slot_cnt = block_size (swap_device) / SECTORS_PER_SLOT;
+  used_slots = bitmap_create (slot_cnt);
+  writing_slots = bitmap_create (slot_cnt);
+  slot_refs = calloc (slot_cnt, sizeof *slot_refs);
+  if (used_slots == NULL || writing_slots == NULL
+      || (slot_cnt > 0 && slot_refs == NULL))
+    PANIC ("can't allocate swap bitmap");
+  if (slot_cnt > 0 && zswap_pages > 0)
+    zswap_init ();
+}
+
+/* Sets up the compressed pool. */
+static void
+zswap_init (void)
+{
+  size_t slot_cnt = bitmap_size (used_slots);
+
+  zpool = palloc_get_multiple (0, zswap_pages);
+  zpool_used = bitmap_create (zswap_pages * PGSIZE / ZBLOCK_SIZE);
+  zpages = calloc (slot_cnt, sizeof *zpages);
+  zbuf = palloc_get_page (0);
+  spill_page = palloc_get_page (0);
+  lz_work = malloc (LZ_WORK_SIZE);
+  if (zpool == NULL || zpool_used == NULL || zpages == NULL
+      || zbuf == NULL || spill_page == NULL || lz_work == NULL)
+    PANIC ("can't allocate %zu-page compressed swap pool", zswap_pages);
+  list_init (&zpage_list);
+}
+
+/* Reserves a free swap slot and returns it, or SWAP_NONE if swap
+   is full.  The caller holds the slot's one use, and must write
+   it with swap_write() before anything else can read it. */
+size_t
+swap_alloc (void)
+{
+  size_t slot;
+
+  lock_acquire (&swap_lock);
+  slot = bitmap_scan_and_flip (used_slots, 0, 1, false);
+  if (slot != BITMAP_ERROR)
+    {
+      slot_refs[slot] = 1;
+      bitmap_mark (writing_slots, slot);
+    }
+  lock_release (&swap_lock);
+  return slot != BITMAP_ERROR ? slot : SWAP_NONE;
+}
+
+/* Adds a page to those sharing swap SLOT, which then stays in
+   use until each of them frees it. */
+void
+swap_dup (size_t slot)
+{
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (used_slots, slot));
+  slot_refs[slot]++;
+  lock_release (&swap_lock);
+}
+
+/* Writes the page at KPAGE to swap SLOT, just reserved with
+   swap_alloc(), compressed in memory if possible.  Wakes up any
+   thread waiting in swap_read() for the slot. */
+void
+swap_write (size_t slot, const void *kpage)
+{
+  bool stored;
+
+  ASSERT (bitmap_test (used_slots, slot));
+  ASSERT (bitmap_test (writing_slots, slot));
+
+  lock_acquire (&swap_lock);
+  stored = zpool != NULL && zswap_store (slot, kpage);
+  lock_release (&swap_lock);
+  if (!stored)
+    disk_write (slot, kpage);
+
+  lock_acquire (&swap_lock);
+  bitmap_reset (writing_slots, slot);
+  cond_broadcast (&slot_written, &swap_lock);
+  lock_release (&swap_lock);
+}
+
+/* Reads swap SLOT into the page at KPAGE, first waiting for
+   the slot to be written if that is still in progress.  Returns
+   true if it had to be read from disk, false if it was held in
+   memory. */
+bool
+swap_read (size_t slot, void *kpage)
+{
+  uint64_t start;
+  struct zpage *z;
+
+  ASSERT (bitmap_test (used_slots, slot));
+
+  lock_acquire (&swap_lock);
+  while (bitmap_test (writing_slots, slot))
+    cond_wait (&slot_written, &swap_lock);
+  start = timer_cycles ();
+  z = zpages != NULL ? zpages[slot] : NULL;
+  if (z != NULL)
+    {
+      if (z->len == 0)
+        memset (kpage, 0, PGSIZE);
+      else
+        lz_decompress (zpool + z->block * ZBLOCK_SIZE, z->len, kpage);
+      zswap_loads++;
+      ram_cycles += timer_cycles () - start;
+      lock_release (&swap_lock);
+      return false;
+    }
+  lock_release (&swap_lock);
+
+  /* A page spilled from the pool stays marked as being written
+     until it is on disk, so the slot's contents are there by
+     now. */
+  disk_read (slot, kpage);
+  disk_cycles += timer_cycles () - start;
+  return true;
+}
+
+/* Releases one page's use of swap SLOT, freeing the slot once no
+   page shares it. */
+void
+swap_free (size_t slot)
+{
+  lock_acquire (&swap_lock);
+  put_slot (slot);
+  lock_release (&swap_lock);
+}
+
+/* Releases one use of SLOT, as swap_free() does.  The caller
+   must hold swap_lock. */
+static void
+put_slot (size_t slot)
+{
+  ASSERT (bitmap_test (used_slots, slot));
+  ASSERT (slot_refs[slot] > 0);
+  if (--slot_refs[slot] == 0)
+    {
+      if (zpages != NULL && zpages[slot] != NULL)
+        zswap_drop (zpages[slot]);
+      bitmap_reset (used_slots, slot);
+    }
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void)
+{
+  if (used_slots == NULL)
+    return;
+  printf ("Swap: %lld reads, %lld writes, %zu of %zu slots in use\n",
+          swap_reads, swap_writes, bitmap_count (used_slots, 0,
+                                                 bitmap_size (used_slots),
+                                                 true),
+          bitmap_size (used_slots));
+  if (zpool == NULL)
+    return;
+  printf ("Zswap: %lld stores (%lld zero, %lld rejected), %lld loads, "
+          "%lld spills, %zu pages held\n",
+          zswap_stores, zswap_zeros, zswap_rejects, zswap_loads,
+          zswap_spills, list_size (&zpage_list));
+  if (stored_bytes > 0)
+    printf ("Zswap: compression ratio %lld.%02lld\n",
+            zswap_stores * PGSIZE / stored_bytes,
+            zswap_stores * PGSIZE * 100 / stored_bytes % 100);
+  printf ("Swap-in latency: %llu cycles from memory, "
+          "%llu cycles from disk\n",
+          zswap_loads > 0 ? ram_cycles / zswap_loads : 0,
+          swap_reads > 0 ? disk_cycles / swap_reads : 0);
+}
+
+/* Tries to store the page at KPAGE in the pool as SLOT, spilling
+   older pages to disk to make room.  Returns false if the page
+   does not compress well enough.  The caller must hold
+   swap_lock, which is released while spilling. */
+static bool
+zswap_store (size_t slot, const void *kpage)
+{
+  const uint32_t *words = kpage;
+  struct zpage *z;
+  size_t len, i;
+
+  ASSERT (lock_held_by_current_thread (&swap_lock));
+  ASSERT (zpages[slot] == NULL);
+
+  z = malloc (sizeof *z);
+  if (z == NULL)
+    return false;
+  z->slot = slot;
+  z->block = 0;
+
+  /* All zeros? */
+  for (i = 0; i < PGSIZE / sizeof *words; i++)
+    if (words[i] != 0)
+      break;
+  if (i == PGSIZE / sizeof *words)
+    {
+      z->len = 0;
+      zswap_zeros++;
+    }
+  else
+    {
+      /* Another store may use ZBUF while a spill has the lock
+         released, so compress again after each one. */
+      for (;;)
+        {
+          size_t block_cnt;
+
+          len = lz_compress (kpage, zbuf, ZMAX_LEN, lz_work);
+          if (len == 0)
+            {
+              zswap_rejects++;
+              free (z);
+              return false;
+            }
+          block_cnt = DIV_ROUND_UP (len, ZBLOCK_SIZE);
+          z->block = bitmap_scan_and_flip (zpool_used, 0, block_cnt, false);
+          if (z->block != BITMAP_ERROR)
+            break;
+          if (!zswap_spill ())
+            {
+              free (z);
+              return false;
+            }
+        }
+      memcpy (zpool + z->block * ZBLOCK_SIZE, zbuf, len);
+      z->len = len;
+    }
+
+  zpages[slot] = z;
+  list_push_back (&zpage_list, &z->elem);
+  zswap_stores++;
+  stored_bytes += z->len;
+  return true;
+}
+
+/* Removes Z from the pool.  The caller must hold swap_lock. */
+static void
+zswap_drop (struct zpage *z)
+{
+  if (z->len > 0)
+    bitmap_set_multiple (zpool_used, z->block,
+                         DIV_ROUND_UP (z->len, ZBLOCK_SIZE), false);
+  list_remove (&z->elem);
+  zpages[z->slot] = NULL;
+  free (z);
+}
+
+/* Moves the oldest page in the pool that takes up pool blocks to
+   its slot on disk, or waits for another thread's spill to do so.
+   Returns false if no page takes up pool blocks.  The caller must
+   hold swap_lock, which is released while writing to disk.
+
+   The page leaves the pool before the write, with its slot
+   marked as being written so that swap_read() waits for it, and
+   with a use of its own so that the slot is not freed and reused
+   meanwhile. */
+static bool
+zswap_spill (void)
+{
+  struct list_elem *e;
+  struct zpage *z;
+  size_t slot;
+
+  if (spill_busy)
+    {
+      while (spill_busy)
+        cond_wait (&slot_written, &swap_lock);
+      return true;
+    }
+
+  for (e = list_begin (&zpage_list); e != list_end (&zpage_list);
+       e = list_next (e))
+    {
+      z = list_entry (e, struct zpage, elem);
+      if (z->len > 0)
+        break;
+    }
+  if (e == list_end (&zpage_list))
+    return false;
+
+  slot = z->slot;
+  lz_decompress (zpool + z->block * ZBLOCK_SIZE, z->len, spill_page);
+  zswap_drop (z);
+  slot_refs[slot]++;
+  bitmap_mark (writing_slots, slot);
+  spill_busy = true;
+  zswap_spills++;
+
+  lock_release (&swap_lock);
+  disk_write (slot, spill_page);
+  lock_acquire (&swap_lock);
+
+  spill_busy = false;
+  bitmap_reset (writing_slots, slot);
+  cond_broadcast (&slot_written, &swap_lock);
+  put_slot (slot);
+  return true;
+}
+
+/* Writes the page at KPAGE to SLOT on the swap device. */
+static void
+disk_write (size_t slot, const void *kpage)
+{
+  size_t i;
+
+  for (i = 0; i < SECTORS_PER_SLOT; i++)
+    block_write (swap_device, slot * SECTORS_PER_SLOT + i,
+                 (const uint8_t *) kpage + i * BLOCK_SECTOR_SIZE);
+  swap_writes++;
+}
+
+/* Reads SLOT on the swap device into the page at KPAGE. */
+static void
+disk_read (size_t slot, void *kpage)
+{
+  size_t i;
+
+  for (i = 0; i < SECTORS_PER_SLOT; i++)
+    block_read (swap_device, slot * SECTORS_PER_SLOT + i,
+                (uint8_t *) kpage + i * BLOCK_SECTOR_SIZE);
+  swap_reads++;
+}
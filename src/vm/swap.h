@@ -0,0 +1,22 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A slot index meaning "no swap slot". */
+#define SWAP_NONE ((size_t) -1)
+
+/* Size of the compressed swap pool, in pages.
+   Controlled by kernel command-line option "-zswap". */
+extern size_t zswap_pages;
+
+void swap_init (void);
+size_t swap_alloc (void);
+void swap_dup (size_t slot);
+void swap_write (size_t slot, const void *kpage);
+bool swap_read (size_t slot, void *kpage);
+void swap_free (size_t slot);
+void swap_print_stats (void);
+
+#endif /* vm/swap.h */